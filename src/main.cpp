@@ -11,12 +11,18 @@ extern "C" {
 static const char *kWifiSsid = "joaquim_wifi";
 static const char *kWifiPass = "mblack#2014";
 static const char *kPrompt = ">";
+static const char *kStateFile = "/state.img";
+// Steps a program runs per loop() pass, so the web server stays responsive.
+static const uint32_t kStepBudget = 500;
 
 static zx80_basic_t vm;
 static WebServer server(80);
 static String out_buffer;
 static volatile bool break_requested = false;
 static bool fs_ready = false;
+static File page_file;
+static uint8_t *page_cache = nullptr;
+static const size_t kPageCacheSize = 4 * ZX80_BASIC_PAGE_SIZE;
 
 static String normalize_filename(String name) {
   name.trim();
@@ -66,11 +72,17 @@ static String extract_filename(const String &line, const char *keyword) {
   return normalize_filename(name);
 }
 
-static String capture_listing() {
+static String take_output() {
+  String out = out_buffer;
   out_buffer = "";
+  return out;
+}
+
+static String capture_listing() {
+  String pending = take_output();
   zx80_basic_list(&vm);
-  String listing = out_buffer;
-  out_buffer = "";
+  String listing = take_output();
+  out_buffer = pending;
   return listing;
 }
 
@@ -89,27 +101,127 @@ static bool save_program(const String &name) {
   return true;
 }
 
+// Reads a whole file into a malloc'd buffer.
+static char *read_file(const String &path, size_t *size) {
+  if (!fs_ready) {
+    return nullptr;
+  }
+  File file = LittleFS.open(path, "r");
+  if (!file) {
+    return nullptr;
+  }
+  size_t len = file.size();
+  char *buf = static_cast<char *>(malloc(len ? len : 1));
+  if (buf) {
+    *size = file.readBytes(buf, len);
+  }
+  file.close();
+  return buf;
+}
+
 static bool load_program(const String &name) {
+  size_t size = 0;
+  char *buf = read_file("/" + name, &size);
+  if (!buf) {
+    return false;
+  }
+  int res = zx80_basic_load_buffer(&vm, buf, size);
+  free(buf);
+  return res == 0; // rejected lines were reported, the load still failed
+}
+
+static int page_write(const uint8_t *buf, size_t len, void *user) {
+  File *file = static_cast<File *>(user);
+  return file->write(buf, len) == len ? 0 : -1;
+}
+
+static size_t page_read(uint32_t offset, uint8_t *buf, size_t len,
+                        void *user) {
+  (void)user;
+  if (!page_file || !page_file.seek(offset)) {
+    return 0;
+  }
+  return page_file.read(buf, len);
+}
+
+// Crunches a program file into <name>.pg and runs it from there, a page at a
+// time, for programs that do not fit in the BASIC RAM. The image is built
+// under a temporary name, so a failure before the build leaves a paged
+// program running on its own image; the build itself resets the VM.
+static bool page_program(const String &name) {
+  if (!page_cache) {
+    page_cache = static_cast<uint8_t *>(malloc(kPageCacheSize));
+  }
+  size_t size = 0;
+  char *buf = page_cache ? read_file("/" + name, &size) : nullptr;
+  if (!buf) {
+    return false;
+  }
+  String path = "/" + name + ".pg";
+  String tmp = path + ".tmp";
+  File out = LittleFS.open(tmp, "w");
+  if (!out) {
+    free(buf);
+    return false;
+  }
+  int res = zx80_basic_page_build(&vm, buf, size, page_write, &out);
+  free(buf);
+  out.close();
+  if (page_file) {
+    page_file.close();
+  }
+  // Rejected lines were reported; like LOAD, the program is not opened.
+  if (res != 0 || (LittleFS.exists(path) && !LittleFS.remove(path)) ||
+      !LittleFS.rename(tmp, path)) {
+    LittleFS.remove(tmp);
+    return false;
+  }
+  page_file = LittleFS.open(path, "r");
+  zx80_pager_t pager = {page_read, nullptr};
+  return page_file &&
+         zx80_basic_page_open(&vm, pager, page_cache, kPageCacheSize) == 0;
+}
+
+// Writes the whole VM state (program, variables, CONT point) for the next
+// boot.
+static bool save_state() {
   if (!fs_ready) {
     return false;
   }
-  String path = "/" + name;
-  File file = LittleFS.open(path, "r");
+  size_t size = zx80_basic_snapshot(&vm, nullptr, 0);
+  uint8_t *buf = size ? static_cast<uint8_t *>(malloc(size)) : nullptr;
+  if (!buf) {
+    return false;
+  }
+  zx80_basic_snapshot(&vm, buf, size);
+  File file = LittleFS.open(kStateFile, "w");
+  bool ok = file && file.write(buf, size) == size;
+  if (file) {
+    file.close();
+  }
+  free(buf);
+  return ok;
+}
+
+static bool restore_state() {
+  if (!fs_ready || !LittleFS.exists(kStateFile)) {
+    return false;
+  }
+  File file = LittleFS.open(kStateFile, "r");
   if (!file) {
     return false;
   }
-  zx80_basic_reset(&vm);
-  while (file.available()) {
-    String line = file.readStringUntil('\n');
-    line.replace("\r", "");
-    line.trim();
-    if (line.isEmpty()) {
-      continue;
-    }
-    zx80_basic_handle_line(&vm, line.c_str());
+  size_t size = file.size();
+  uint8_t *buf = static_cast<uint8_t *>(malloc(size ? size : 1));
+  if (!buf) {
+    file.close();
+    return false;
   }
+  size_t got = file.read(buf, size);
   file.close();
-  return true;
+  bool ok = zx80_basic_restore(&vm, buf, got) == 0;
+  free(buf);
+  return ok;
 }
 
 static String list_programs() {
@@ -167,6 +279,19 @@ static bool handle_special_command(const String &line, String &response) {
     response = save_program(name) ? "OK" : "ERR";
     return true;
   }
+  if (upper.startsWith("PAGE")) {
+    String name = extract_filename(trimmed, "PAGE");
+    if (name.isEmpty()) {
+      response = "ERR";
+      return true;
+    }
+    response = page_program(name) ? "OK" : "ERR";
+    return true;
+  }
+  if (upper == "SNAP") {
+    response = save_state() ? "OK" : "ERR";
+    return true;
+  }
   if (upper.startsWith("LOAD")) {
     String name = extract_filename(trimmed, "LOAD");
     if (name.isEmpty()) {
@@ -703,6 +828,23 @@ async function sendLine(line) {
     applyOutput(parsed.out || "");
     promptText = parsed.prompt || ">";
     statusEl.textContent = "online";
+    if (response.headers.get("X-Running") === "1") {
+      setTimeout(poll, 100);
+    }
+  } catch (error) {
+    statusEl.textContent = "offline";
+  }
+}
+
+// Fetches the output of a program that is still running.
+async function poll() {
+  try {
+    const response = await fetch("/poll");
+    const text = await response.text();
+    applyOutput(parseResponse(text).out || "");
+    if (response.headers.get("X-Running") === "1") {
+      setTimeout(poll, 100);
+    }
   } catch (error) {
     statusEl.textContent = "offline";
   }
@@ -786,9 +928,9 @@ setInterval(() => {
 }, 500);
 )JS";
 
-static void web_write_char(char c, void *user) {
+static void web_write_buf(const char *buf, size_t len, void *user) {
   (void)user;
-  out_buffer += c;
+  out_buffer.concat(buf, len);
 }
 
 static int web_break_check(void *user) {
@@ -800,37 +942,36 @@ static int web_break_check(void *user) {
   return 0;
 }
 
-static int web_read_line(char *buf, size_t max_len, void *user) {
-  (void)user;
-  (void)buf;
-  (void)max_len;
-  return -1;
-}
-
 static void setup_vm() {
   zx80_io_t io;
-  io.write_char = web_write_char;
-  io.read_line = web_read_line;
+  io.write_char = nullptr;
+  io.write_buf = web_write_buf;
+  io.read_line = nullptr; // INPUT waits for the next /line
   io.break_check = web_break_check;
   io.user = nullptr;
   zx80_basic_init_default(&vm, io);
   zx80_basic_reset(&vm);
+  vm.step_budget = kStepBudget;
+  if (restore_state()) {
+    Serial.println("State restored");
+  }
 }
 
 static void send_response(const String &out) {
   String payload = String("PROMPT:") + kPrompt + "\nDATA:\n" + out;
   server.sendHeader("Cache-Control", "no-store");
+  server.sendHeader("X-Running", vm.run_state == ZX80_RUNNING ? "1" : "0");
   server.send(200, "text/plain", payload);
 }
 
 static String handle_line(const String &line) {
   String response;
-  if (handle_special_command(line, response)) {
-    return response;
+  if (vm.run_state != ZX80_WAITING_INPUT &&
+      handle_special_command(line, response)) {
+    return take_output() + response;
   }
-  out_buffer = "";
   zx80_basic_handle_line(&vm, line.c_str());
-  return out_buffer;
+  return take_output();
 }
 
 static void setup_wifi() {
@@ -887,8 +1028,11 @@ static void setup_web() {
     String line = server.arg("plain");
     send_response(handle_line(line));
   });
+  // Output of a program still running after its /line request.
+  server.on("/poll", HTTP_GET, []() { send_response(take_output()); });
   server.on("/break", HTTP_POST, []() {
     break_requested = true;
+    vm.poll_now = 1; // FAST mode would otherwise poll only now and then
     send_response("");
   });
   server.begin();
@@ -907,4 +1051,7 @@ void setup() {
 
 void loop() {
   server.handleClient();
+  if (vm.run_state == ZX80_RUNNING) {
+    zx80_basic_step(&vm, kStepBudget);
+  }
 }
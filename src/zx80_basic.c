@@ -2,50 +2,285 @@
 #include "zx80_basic.h"
 
 #include <ctype.h>
+#include <limits.h>
 #include <string.h>
 
 static uint8_t default_ram[ZX80_BASIC_DEFAULT_RAM];
-static uint8_t default_array_mem[ZX80_BASIC_DEFAULT_ARRAY_MEM];
+static uint8_t default_str_mem[ZX80_BASIC_DEFAULT_STR_MEM];
+#if ZX80_BASIC_USE_VM
+static uint8_t default_code[ZX80_BASIC_DEFAULT_CODE];
+#endif
+
+// Stored lines are crunched: keywords become one-byte tokens and numeric
+// literals are kept in binary behind a width marker, as on the real ZX80.
+// Single-letter variables stay as their letter (slots 0..25); longer names
+// are interned and stored as TOK_VAR plus a one-byte slot number. Fixed-point
+// builds store literals with a fraction as TOK_FIX plus the Q16.16 value.
+enum {
+  TOK_NUM8 = 0x01,
+  TOK_NUM16 = 0x02,
+  TOK_NUM32 = 0x03,
+  TOK_VAR = 0x04,
+  TOK_FIX = 0x05,
+  TOK_FIRST = 0x80,
+  TOK_REM = TOK_FIRST,
+  TOK_PRINT,
+  TOK_LET,
+  TOK_INPUT,
+  TOK_GOTO,
+  TOK_IF,
+  TOK_END,
+  TOK_STOP,
+  TOK_RUN,
+  TOK_LIST,
+  TOK_NEW,
+  TOK_CLS,
+  TOK_CONT,
+  TOK_GOSUB,
+  TOK_RETURN,
+  TOK_FOR,
+  TOK_NEXT,
+  TOK_POKE,
+  TOK_RAND,
+  TOK_DIM,
+  TOK_LOAD,
+  TOK_SAVE,
+  TOK_THEN,
+  TOK_TO,
+  TOK_STEP,
+  TOK_RND,
+  TOK_PEEK,
+  TOK_LEN,
+  TOK_AND,
+  TOK_OR,
+  TOK_NOT,
+  TOK_FILL,
+  TOK_COPY,
+  TOK_SORT,
+  TOK_SUM,
+  TOK_USR,
+  TOK_BYTE,
+  TOK_WORD,
+  TOK_FAST,
+  TOK_SLOW,
+  TOK_LAST
+};
+
+// Variable slots live at the top of vm->ram: vars[0..var_count) with the
+// interned names (length byte + upper-case name, slot order from 26) just
+// below them. Slot 0xFF is reserved for "any variable" in OP_NEXT.
+#define VAR_LETTERS 26
+#define VAR_SLOTS_MAX ZX80_BASIC_VAR_SLOTS
+
+// Numeric values. With ZX80_BASIC_FIXED a zx80_int holds Q16.16 fixed point
+// and these convert and scale; otherwise they compile to plain int32 math.
+// Line numbers, addresses, indices and lengths are always integers.
+#if ZX80_BASIC_FIXED
+#define NUM_FROM_INT(i) ((zx80_int)((uint32_t)(i) << 16))
+#define NUM_TO_INT(v) ((zx80_int)((v) >> 16))
+#define NUM_MUL(a, b) ((zx80_int)(((int64_t)(a) * (b)) >> 16))
+#define NUM_DIV(a, b) ((zx80_int)(((int64_t)(a) * 65536) / (b)))
+#define NUM_AND(a, b) NUM_FROM_INT(NUM_TO_INT(a) & NUM_TO_INT(b))
+#define NUM_OR(a, b) NUM_FROM_INT(NUM_TO_INT(a) | NUM_TO_INT(b))
+#define NUM_NOT(a) NUM_FROM_INT(~NUM_TO_INT(a))
+#else
+#define NUM_FROM_INT(i) ((zx80_int)(i))
+#define NUM_TO_INT(v) (v)
+#define NUM_MUL(a, b) ((a) * (b))
+#define NUM_DIV(a, b) ((a) / (b))
+#define NUM_AND(a, b) ((a) & (b))
+#define NUM_OR(a, b) ((a) | (b))
+#define NUM_NOT(a) (~(a))
+#endif
+#define NUM_TRUE NUM_FROM_INT(-1)
+
+// vm->code_state
+#define CODE_STALE 0
+#define CODE_READY 1
+#define CODE_NO_FIT (-1)
+
+#define KW_LEAD 0x01
+#define KW_TRAIL 0x02
+#define KW_STMT (KW_LEAD | KW_TRAIL)
+
+typedef struct {
+  const char *name;
+  uint8_t flags;
+} keyword_t;
+
+static const keyword_t keywords[TOK_LAST - TOK_FIRST] = {
+    [TOK_REM - TOK_FIRST] = {"REM", KW_STMT},
+    [TOK_PRINT - TOK_FIRST] = {"PRINT", KW_STMT},
+    [TOK_LET - TOK_FIRST] = {"LET", KW_STMT},
+    [TOK_INPUT - TOK_FIRST] = {"INPUT", KW_STMT},
+    [TOK_GOTO - TOK_FIRST] = {"GOTO", KW_STMT},
+    [TOK_IF - TOK_FIRST] = {"IF", KW_STMT},
+    [TOK_END - TOK_FIRST] = {"END", KW_STMT},
+    [TOK_STOP - TOK_FIRST] = {"STOP", KW_STMT},
+    [TOK_RUN - TOK_FIRST] = {"RUN", KW_STMT},
+    [TOK_LIST - TOK_FIRST] = {"LIST", KW_STMT},
+    [TOK_NEW - TOK_FIRST] = {"NEW", KW_STMT},
+    [TOK_CLS - TOK_FIRST] = {"CLS", KW_STMT},
+    [TOK_CONT - TOK_FIRST] = {"CONTINUE", KW_STMT},
+    [TOK_GOSUB - TOK_FIRST] = {"GOSUB", KW_STMT},
+    [TOK_RETURN - TOK_FIRST] = {"RETURN", KW_STMT},
+    [TOK_FOR - TOK_FIRST] = {"FOR", KW_STMT},
+    [TOK_NEXT - TOK_FIRST] = {"NEXT", KW_STMT},
+    [TOK_POKE - TOK_FIRST] = {"POKE", KW_STMT},
+    [TOK_RAND - TOK_FIRST] = {"RANDOMISE", KW_STMT},
+    [TOK_DIM - TOK_FIRST] = {"DIM", KW_STMT},
+    [TOK_LOAD - TOK_FIRST] = {"LOAD", KW_STMT},
+    [TOK_SAVE - TOK_FIRST] = {"SAVE", KW_STMT},
+    [TOK_THEN - TOK_FIRST] = {"THEN", KW_LEAD | KW_TRAIL},
+    [TOK_TO - TOK_FIRST] = {"TO", KW_LEAD | KW_TRAIL},
+    [TOK_STEP - TOK_FIRST] = {"STEP", KW_LEAD | KW_TRAIL},
+    [TOK_RND - TOK_FIRST] = {"RND", 0},
+    [TOK_PEEK - TOK_FIRST] = {"PEEK", 0},
+    [TOK_LEN - TOK_FIRST] = {"LEN", 0},
+    [TOK_AND - TOK_FIRST] = {"AND", KW_LEAD | KW_TRAIL},
+    [TOK_OR - TOK_FIRST] = {"OR", KW_LEAD | KW_TRAIL},
+    [TOK_NOT - TOK_FIRST] = {"NOT", KW_TRAIL},
+    [TOK_FILL - TOK_FIRST] = {"FILL", KW_STMT},
+    [TOK_COPY - TOK_FIRST] = {"COPY", KW_STMT},
+    [TOK_SORT - TOK_FIRST] = {"SORT", KW_STMT},
+    [TOK_SUM - TOK_FIRST] = {"SUM", 0},
+    [TOK_USR - TOK_FIRST] = {"USR", KW_TRAIL},
+    [TOK_BYTE - TOK_FIRST] = {"BYTE", KW_TRAIL},
+    [TOK_WORD - TOK_FIRST] = {"WORD", KW_TRAIL},
+    [TOK_FAST - TOK_FIRST] = {"FAST", KW_STMT},
+    [TOK_SLOW - TOK_FIRST] = {"SLOW", KW_STMT},
+};
+
+static const struct {
+  const char *name;
+  uint8_t token;
+} keyword_aliases[] = {
+    {"CONT", TOK_CONT},
+    {"RAND", TOK_RAND},
+};
+
+// Output is staged in out_buf and handed to write_buf in one call (or to
+// write_char a byte at a time) when it fills, at each break poll and when
+// the call into the interpreter returns.
+static void out_flush(zx80_basic_t *vm) {
+  if (vm->io.write_buf) {
+    if (vm->out_len) {
+      vm->io.write_buf(vm->out_buf, vm->out_len, vm->io.user);
+    }
+  } else if (vm->io.write_char) {
+    for (size_t i = 0; i < vm->out_len; ++i) {
+      vm->io.write_char(vm->out_buf[i], vm->io.user);
+    }
+  }
+  vm->out_len = 0;
+}
 
 static void write_char(zx80_basic_t *vm, char c) {
-  if (vm->io.write_char) {
-    vm->io.write_char(c, vm->io.user);
+  vm->out_buf[vm->out_len++] = c;
+  if (vm->out_len == sizeof(vm->out_buf)) {
+    out_flush(vm);
+  }
+}
+
+static void write_mem(zx80_basic_t *vm, const char *s, size_t n) {
+  while (n) {
+    size_t room = sizeof(vm->out_buf) - vm->out_len;
+    size_t k = (n < room) ? n : room;
+    memcpy(vm->out_buf + vm->out_len, s, k);
+    vm->out_len += k;
+    s += k;
+    n -= k;
+    if (vm->out_len == sizeof(vm->out_buf)) {
+      out_flush(vm);
+    }
+  }
+}
+
+// Switching only flips the flag; poll_now makes the running engine reload
+// its break poll countdown for the new mode at the next statement.
+static void set_fast(zx80_basic_t *vm, int fast) {
+  if (!fast) {
+    out_flush(vm);
   }
+  vm->fast = fast != 0;
+  vm->poll_now = 1;
 }
 
 static void write_str(zx80_basic_t *vm, const char *s) {
-  while (s && *s) {
-    write_char(vm, *s++);
+  if (s) {
+    write_mem(vm, s, strlen(s));
   }
 }
 
+static const char digit_pairs[] = "00010203040506070809"
+                                  "10111213141516171819"
+                                  "20212223242526272829"
+                                  "30313233343536373839"
+                                  "40414243444546474849"
+                                  "50515253545556575859"
+                                  "60616263646566676869"
+                                  "70717273747576777879"
+                                  "80818283848586878889"
+                                  "90919293949596979899";
+
+// Converts two digits per division; the magnitude is taken unsigned so
+// -2147483648 prints too.
 static void write_int(zx80_basic_t *vm, zx80_int v) {
-  char buf[16];
-  int pos = 0;
-  if (v == 0) {
-    buf[pos++] = '0';
+  char buf[12];
+  char *p = buf + sizeof(buf);
+  uint32_t u = (v < 0) ? 0u - (uint32_t)v : (uint32_t)v;
+  while (u >= 100) {
+    uint32_t r = u % 100;
+    u /= 100;
+    p -= 2;
+    memcpy(p, digit_pairs + 2 * r, 2);
+  }
+  if (u >= 10) {
+    p -= 2;
+    memcpy(p, digit_pairs + 2 * u, 2);
   } else {
-    if (v < 0) {
-      buf[pos++] = '-';
-      v = -v;
-    }
-    char tmp[12];
-    int tpos = 0;
-    while (v > 0 && tpos < (int)sizeof(tmp)) {
-      tmp[tpos++] = (char)('0' + (v % 10));
-      v /= 10;
+    *--p = (char)('0' + u);
+  }
+  if (v < 0) {
+    *--p = '-';
+  }
+  write_mem(vm, p, (size_t)(buf + sizeof(buf) - p));
+}
+
+// Prints a numeric value; fixed point shows up to four rounded decimals.
+static void write_num(zx80_basic_t *vm, zx80_int v) {
+#if ZX80_BASIC_FIXED
+  uint32_t mag = (v < 0) ? 0u - (uint32_t)v : (uint32_t)v;
+  uint32_t whole = mag >> 16;
+  uint32_t frac = ((mag & 0xFFFFu) * 10000u + 0x8000u) >> 16;
+  if (frac >= 10000u) {
+    whole++;
+    frac -= 10000u;
+  }
+  if (v < 0 && (whole || frac)) {
+    write_char(vm, '-');
+  }
+  write_int(vm, (zx80_int)whole);
+  if (frac) {
+    char digits[4];
+    int len = 4;
+    for (int i = 3; i >= 0; --i) {
+      digits[i] = (char)('0' + frac % 10u);
+      frac /= 10u;
     }
-    while (tpos > 0) {
-      buf[pos++] = tmp[--tpos];
+    while (digits[len - 1] == '0') {
+      len--;
     }
+    write_char(vm, '.');
+    write_mem(vm, digits, (size_t)len);
   }
-  buf[pos] = '\0';
-  write_str(vm, buf);
+#else
+  write_int(vm, v);
+#endif
 }
 
 static void write_newline(zx80_basic_t *vm) {
-  write_char(vm, '\r');
-  write_char(vm, '\n');
+  write_mem(vm, "\r\n", 2);
 }
 
 static uint16_t read_u16(const uint8_t *p) {
@@ -57,6 +292,15 @@ static void write_u16(uint8_t *p, uint16_t v) {
   p[1] = (uint8_t)((v >> 8) & 0xFF);
 }
 
+static uint32_t read_u32(const uint8_t *p) {
+  return (uint32_t)read_u16(p) | (uint32_t)read_u16(p + 2) << 16;
+}
+
+static void write_u32(uint8_t *p, uint32_t v) {
+  write_u16(p, (uint16_t)(v & 0xFFFF));
+  write_u16(p + 2, (uint16_t)(v >> 16));
+}
+
 static const char *skip_ws(const char *s) {
   while (*s && isspace((unsigned char)*s)) {
     s++;
@@ -109,8 +353,138 @@ static const char *parse_int(const char *s, zx80_int *out) {
   return s;
 }
 
+#if ZX80_BASIC_FIXED
+// Reads [-|+]digits[.digits] (or .digits) as a rounded Q16.16 value.
+static const char *parse_fixed(const char *s, zx80_int *out) {
+  s = skip_ws(s);
+  int neg = 0;
+  if (*s == '-' || *s == '+') {
+    neg = (*s == '-');
+    s++;
+  }
+  if (!isdigit((unsigned char)*s) &&
+      !(*s == '.' && isdigit((unsigned char)s[1]))) {
+    return NULL;
+  }
+  uint32_t whole = 0;
+  while (isdigit((unsigned char)*s)) {
+    whole = whole * 10u + (uint32_t)(*s++ - '0');
+  }
+  uint32_t num = 0;
+  uint32_t den = 1;
+  if (*s == '.') {
+    s++;
+    while (isdigit((unsigned char)*s)) {
+      if (den < 1000000000u) {
+        num = num * 10u + (uint32_t)(*s - '0');
+        den *= 10u;
+      }
+      s++;
+    }
+  }
+  uint32_t v = (whole << 16) +
+               (uint32_t)((((uint64_t)num << 16) + den / 2) / den);
+  *out = neg ? (zx80_int)(0u - v) : (zx80_int)v;
+  return s;
+}
+#endif
+
+static int is_tok(const char *s, uint8_t tok) {
+  return (uint8_t)*s == tok;
+}
+
+static const char *parse_num(const char *s, zx80_int *out) {
+  const uint8_t *p = (const uint8_t *)skip_ws(s);
+  switch (*p) {
+  case TOK_NUM8:
+    *out = p[1];
+    return (const char *)(p + 2);
+  case TOK_NUM16:
+    *out = read_u16(p + 1);
+    return (const char *)(p + 3);
+  case TOK_NUM32:
+    *out = (zx80_int)read_u32(p + 1);
+    return (const char *)(p + 5);
+  default:
+    return NULL;
+  }
+}
+
+// Numeric value of a literal token (parse_num gives integers as written).
+static const char *parse_literal(const char *s, zx80_int *out) {
+  const uint8_t *p = (const uint8_t *)skip_ws(s);
+  if (*p == TOK_FIX) {
+    *out = (zx80_int)read_u32(p + 1);
+    return (const char *)(p + 5);
+  }
+  s = parse_num(s, out);
+  if (s) {
+    *out = NUM_FROM_INT(*out);
+  }
+  return s;
+}
+
+static const char *parse_line_num(const char *s, uint16_t *out) {
+  zx80_int line = 0;
+  s = parse_num(s, &line);
+  if (!s || line < 0 || line > 65535) {
+    return NULL;
+  }
+  *out = (uint16_t)line;
+  return s;
+}
+
+static int is_stmt_end(const char *s) {
+  return *s == '\0' || *s == ':';
+}
+
+// Returns the start of the statement after the one at s: just past its ':'
+// separator, or the line's NUL terminator when s is the last statement. REM
+// runs to the end of the line.
+static const char *stmt_next(const char *s) {
+  while (*s && *s != ':') {
+    uint8_t c = (uint8_t)*s;
+    if (c == TOK_REM) {
+      return s + strlen(s);
+    }
+    if (c == '"') {
+      s++;
+      while (*s && *s != '"') {
+        s++;
+      }
+      if (*s) {
+        s++;
+      }
+      continue;
+    }
+    if (c == TOK_VAR) {
+      s += 2;
+      continue;
+    }
+    zx80_int v = 0;
+    const char *ns = parse_literal(s, &v);
+    s = ns ? ns : s + 1;
+  }
+  return (*s == ':') ? s + 1 : s;
+}
+
+static const char *line_end(const char *s) {
+  while (*s) {
+    s = stmt_next(s);
+  }
+  return s;
+}
+
+static int is_var_start(const char *s) {
+  return is_name_char(*s) || is_tok(s, TOK_VAR);
+}
+
 static const char *parse_var(const char *s, int *out_index) {
   s = skip_ws(s);
+  if (is_tok(s, TOK_VAR)) {
+    *out_index = (uint8_t)s[1];
+    return s + 2;
+  }
   if (!is_name_char(*s)) {
     return NULL;
   }
@@ -122,32 +496,250 @@ static const char *parse_var(const char *s, int *out_index) {
   return s + 1;
 }
 
+enum { REL_NONE, REL_EQ, REL_NE, REL_LT, REL_GT, REL_LE, REL_GE };
+
+static const char *parse_relop(const char *s, int *op) {
+  *op = REL_NONE;
+  if (*s != '<' && *s != '>' && *s != '=') {
+    return s;
+  }
+  char op1 = *s++;
+  char op2 = '\0';
+  if ((op1 == '<' || op1 == '>') && (*s == '=' || *s == '>')) {
+    op2 = *s++;
+  }
+  if (op1 == '<' && op2 == '>') {
+    *op = REL_NE;
+  } else if (op1 == '<' && op2 == '=') {
+    *op = REL_LE;
+  } else if (op1 == '>' && op2 == '=') {
+    *op = REL_GE;
+  } else if (op1 == '<') {
+    *op = REL_LT;
+  } else if (op1 == '>') {
+    *op = REL_GT;
+  } else {
+    *op = REL_EQ;
+  }
+  return s;
+}
+
+// cmp is <0, 0 or >0 as the left operand is below, equal to or above the right.
+static int relop_holds(int op, int cmp) {
+  switch (op) {
+  case REL_EQ:
+    return cmp == 0;
+  case REL_NE:
+    return cmp != 0;
+  case REL_LT:
+    return cmp < 0;
+  case REL_GT:
+    return cmp > 0;
+  case REL_LE:
+    return cmp <= 0;
+  default:
+    return cmp >= 0;
+  }
+}
+
+// Binary operator precedence, loosest first. NOT is a prefix operator that
+// takes a relation, so NOT A=B is NOT (A=B) and NOT A AND B is (NOT A) AND B.
+enum { PREC_OR = 1, PREC_AND, PREC_NOT, PREC_REL, PREC_ADD, PREC_MUL };
+
+// Recognises the binary operator at s: returns its precedence (0 if none)
+// and sets *op to a REL_* code, the operator character, or TOK_AND/TOK_OR.
+static int binary_op(const char *s, int *op, const char **next) {
+  switch ((uint8_t)*s) {
+  case '*':
+  case '/':
+    *op = *s;
+    *next = s + 1;
+    return PREC_MUL;
+  case '+':
+  case '-':
+    *op = *s;
+    *next = s + 1;
+    return PREC_ADD;
+  case TOK_AND:
+    *op = TOK_AND;
+    *next = s + 1;
+    return PREC_AND;
+  case TOK_OR:
+    *op = TOK_OR;
+    *next = s + 1;
+    return PREC_OR;
+  default:
+    *next = parse_relop(s, op);
+    return (*op != REL_NONE) ? PREC_REL : 0;
+  }
+}
+
+static zx80_int apply_binary(int op, zx80_int a, zx80_int b) {
+  switch (op) {
+  case '*':
+    return NUM_MUL(a, b);
+  case '/':
+    return (b == 0) ? 0 : NUM_DIV(a, b);
+  case '+':
+    return a + b;
+  case '-':
+    return a - b;
+  case TOK_AND:
+    return NUM_AND(a, b);
+  case TOK_OR:
+    return NUM_OR(a, b);
+  default:
+    return relop_holds(op, (a < b) ? -1 : (a > b)) ? NUM_TRUE : 0;
+  }
+}
+
 static const char *parse_expr(zx80_basic_t *vm, const char *s, zx80_int *out);
+static const char *parse_usr(zx80_basic_t *vm, const char *s, zx80_int *out);
+
+// zx80_array_t.shift per cell type: log2 of the cell size.
+enum { ARRAY_BYTE = 0, ARRAY_WORD = 1, ARRAY_INT = 2 };
 
 static zx80_array_t *find_array(zx80_basic_t *vm, int var) {
-  for (int i = 0; i < vm->array_count; ++i) {
-    if (vm->arrays[i].var == var) {
-      return &vm->arrays[i];
-    }
-  }
-  return NULL;
+  int n = vm->array_of[var];
+  return n ? &vm->arrays[n - 1] : NULL;
 }
 
-static zx80_int *array_at(zx80_basic_t *vm, zx80_array_t *arr, zx80_int i,
-                          zx80_int j) {
-  if (!arr || !vm->array_mem) {
+// Sizes are never negative, so one unsigned compare per index checks both
+// bounds. Returns the cell's bytes; cell_load()/cell_store() convert them.
+static uint8_t *array_at(zx80_basic_t *vm, zx80_array_t *arr, zx80_int i,
+                         zx80_int j) {
+  if (!arr || (uint32_t)i > (uint32_t)arr->size1 ||
+      (uint32_t)j > (uint32_t)arr->size2) {
     return NULL;
   }
-  if (i < 0 || j < 0) {
+  size_t index = (size_t)i + arr->stride * (size_t)j;
+  return vm->array_mem + arr->offset + (index << arr->shift);
+}
+
+// BYTE cells hold 0..255 and WORD cells -32768..32767 whole numbers; stores
+// keep the low bits, like POKE.
+static zx80_int cell_load(const zx80_array_t *arr, const uint8_t *p) {
+  switch (arr->shift) {
+  case ARRAY_BYTE:
+    return NUM_FROM_INT(*p);
+  case ARRAY_WORD:
+    return NUM_FROM_INT(*(const int16_t *)p);
+  default:
+    return *(const zx80_int *)p;
+  }
+}
+
+static void cell_store(const zx80_array_t *arr, uint8_t *p, zx80_int v) {
+  switch (arr->shift) {
+  case ARRAY_BYTE:
+    *p = (uint8_t)NUM_TO_INT(v);
+    break;
+  case ARRAY_WORD:
+    *(int16_t *)p = (int16_t)NUM_TO_INT(v);
+    break;
+  default:
+    *(zx80_int *)p = v;
+    break;
+  }
+}
+
+// Whole-array kernels for FILL, SUM and SORT, one set per cell type. Plain
+// counted loops over the cells so the compiler can vectorize or unroll them.
+// Shell sort (Ciura gaps): in place, no recursion, and near insertion sort
+// speed on the small arrays array_mem can hold.
+static const uint16_t sort_gaps[] = {701, 301, 132, 57, 23, 10, 4, 1};
+
+#define ARRAY_KERNELS(suffix, type)                                          \
+  static void array_fill_##suffix(type *p, size_t n, type v) {               \
+    for (size_t i = 0; i < n; ++i) {                                         \
+      p[i] = v;                                                              \
+    }                                                                        \
+  }                                                                          \
+  static uint32_t array_sum_##suffix(const type *p, size_t n) {              \
+    uint32_t acc = 0; /* wraps like the + operator */                        \
+    for (size_t i = 0; i < n; ++i) {                                         \
+      acc += (uint32_t)p[i];                                                 \
+    }                                                                        \
+    return acc;                                                              \
+  }                                                                          \
+  static void array_sort_##suffix(type *p, size_t n) {                       \
+    for (size_t g = 0; g < sizeof(sort_gaps) / sizeof(sort_gaps[0]); ++g) { \
+      size_t gap = sort_gaps[g];                                             \
+      for (size_t i = gap; i < n; ++i) {                                     \
+        type v = p[i];                                                       \
+        size_t j = i;                                                        \
+        while (j >= gap && p[j - gap] > v) {                                 \
+          p[j] = p[j - gap];                                                 \
+          j -= gap;                                                          \
+        }                                                                    \
+        p[j] = v;                                                            \
+      }                                                                      \
+    }                                                                        \
+  }
+
+ARRAY_KERNELS(int, zx80_int)
+ARRAY_KERNELS(word, int16_t)
+ARRAY_KERNELS(byte, uint8_t)
+#undef ARRAY_KERNELS
+
+// Parses an array name for the whole-array statements and SUM.
+static const char *parse_array_ref(zx80_basic_t *vm, const char *s,
+                                   zx80_array_t **out) {
+  int idx = 0;
+  s = parse_var(skip_ws(s), &idx);
+  if (!s || *s == '$') {
     return NULL;
   }
-  if (i > arr->size1 || j > arr->size2) {
+  *out = find_array(vm, idx);
+  return s;
+}
+
+static uint8_t *array_cells(zx80_basic_t *vm, zx80_array_t *arr,
+                            size_t *count) {
+  if (!arr || !arr->dims) {
     return NULL;
   }
-  size_t stride = (size_t)(arr->size1 + 1);
-  size_t index = (size_t)i + stride * (size_t)j;
-  zx80_int *base = (zx80_int *)(vm->array_mem + arr->offset);
-  return &base[index];
+  *count = arr->stride * (size_t)(arr->size2 + 1);
+  return vm->array_mem + arr->offset;
+}
+
+static void array_fill(zx80_array_t *arr, uint8_t *p, size_t n, zx80_int v) {
+  switch (arr->shift) {
+  case ARRAY_BYTE:
+    array_fill_byte(p, n, (uint8_t)NUM_TO_INT(v));
+    break;
+  case ARRAY_WORD:
+    array_fill_word((int16_t *)p, n, (int16_t)NUM_TO_INT(v));
+    break;
+  default:
+    array_fill_int((zx80_int *)p, n, v);
+    break;
+  }
+}
+
+static zx80_int array_sum(zx80_array_t *arr, const uint8_t *p, size_t n) {
+  switch (arr->shift) {
+  case ARRAY_BYTE:
+    return NUM_FROM_INT((zx80_int)array_sum_byte(p, n));
+  case ARRAY_WORD:
+    return NUM_FROM_INT((zx80_int)array_sum_word((const int16_t *)p, n));
+  default:
+    return (zx80_int)array_sum_int((const zx80_int *)p, n);
+  }
+}
+
+static void array_sort(zx80_array_t *arr, uint8_t *p, size_t n) {
+  switch (arr->shift) {
+  case ARRAY_BYTE:
+    array_sort_byte(p, n);
+    break;
+  case ARRAY_WORD:
+    array_sort_word((int16_t *)p, n);
+    break;
+  default:
+    array_sort_int((zx80_int *)p, n);
+    break;
+  }
 }
 
 static const char *parse_indices(zx80_basic_t *vm, const char *s, zx80_int *i,
@@ -161,6 +753,7 @@ static const char *parse_indices(zx80_basic_t *vm, const char *s, zx80_int *i,
   if (!s) {
     return NULL;
   }
+  *i = NUM_TO_INT(*i);
   s = skip_ws(s);
   *dims = 1;
   *j = 0;
@@ -170,6 +763,7 @@ static const char *parse_indices(zx80_basic_t *vm, const char *s, zx80_int *i,
     if (!s) {
       return NULL;
     }
+    *j = NUM_TO_INT(*j);
     *dims = 2;
   }
   s = skip_ws(s);
@@ -184,326 +778,2928 @@ static size_t align_up(size_t v, size_t a) {
 }
 
 static zx80_int rand_next(zx80_basic_t *vm, zx80_int range) {
+  range = NUM_TO_INT(range);
   if (range <= 0) {
     return 0;
   }
   vm->rand_state = (uint32_t)(vm->rand_state * 1103515245u + 12345u);
-  return (zx80_int)((vm->rand_state % (uint32_t)range) + 1);
+  return NUM_FROM_INT((vm->rand_state % (uint32_t)range) + 1);
 }
 
-static const char *parse_factor(zx80_basic_t *vm, const char *s,
-                                zx80_int *out) {
-  s = skip_ws(s);
-  if (*s == '(') {
-    s++;
-    s = parse_expr(vm, s, out);
-    if (!s) {
-      return NULL;
-    }
-    s = skip_ws(s);
-    if (*s != ')') {
-      return NULL;
+// String arena. Values live in vm->str_mem as blocks of {owner, length,
+// bytes} allocated by bumping str_mem_used; owner indexes vm->str_vars, or
+// is STR_DEAD once the variable has been given a new value. When the arena
+// fills, the live blocks are slid down over the dead ones. Expression
+// temporaries are stacked above str_mem_used at offsets relative to it
+// (str_temp is the top), so a collection carries them along.
+#define STR_MAX 255
+#define STR_DEAD 0xFF
+#define STR_NONE ((size_t)-1)
+
+static zx80_str_var_t *find_str(zx80_basic_t *vm, int var) {
+  for (int i = 0; i < vm->str_var_count; ++i) {
+    if (vm->str_vars[i].var == var) {
+      return &vm->str_vars[i];
     }
-    return s + 1;
   }
-  if (*s == '+' || *s == '-') {
-    char sign = *s++;
-    s = parse_factor(vm, s, out);
-    if (!s) {
-      return NULL;
+  return NULL;
+}
+
+static uint8_t *str_temp_at(zx80_basic_t *vm, size_t rel) {
+  return vm->str_mem + vm->str_mem_used + rel;
+}
+
+static void str_collect(zx80_basic_t *vm) {
+  size_t dst = 0;
+  size_t src = 0;
+  while (src < vm->str_mem_used) {
+    uint8_t *b = vm->str_mem + src;
+    size_t n = 2 + (size_t)b[1];
+    uint8_t owner = b[0]; // the move below may overwrite b
+    if (owner != STR_DEAD) {
+      memmove(vm->str_mem + dst, b, n);
+      vm->str_vars[owner].offset = dst;
+      dst += n;
     }
-    if (sign == '-') {
-      *out = -*out;
+    src += n;
+  }
+  memmove(vm->str_mem + dst, vm->str_mem + vm->str_mem_used, vm->str_temp);
+  vm->str_mem_used = dst;
+  vm->str_collections++;
+}
+
+// Makes room for n more bytes on top of the temporaries; may collect.
+static int str_reserve(zx80_basic_t *vm, size_t n) {
+  if (!vm->str_mem) {
+    return -1;
+  }
+  if (vm->str_mem_used + vm->str_temp + n > vm->str_mem_size) {
+    str_collect(vm);
+    if (vm->str_mem_used + vm->str_temp + n > vm->str_mem_size) {
+      return -1;
     }
-    return s;
   }
-  const char *kw = match_kw(s, "RND");
-  if (kw) {
-    s = kw;
-    s = skip_ws(s);
-    if (*s != '(') {
-      return NULL;
+  if (vm->str_mem_used + vm->str_temp + n > vm->str_peak) {
+    vm->str_peak = vm->str_mem_used + vm->str_temp + n;
+  }
+  return 0;
+}
+
+static const uint8_t *str_value(zx80_basic_t *vm, int var, size_t *len) {
+  zx80_str_var_t *sv = find_str(vm, var);
+  if (!sv || sv->offset == STR_NONE) {
+    *len = 0;
+    return NULL;
+  }
+  const uint8_t *b = vm->str_mem + sv->offset;
+  *len = b[1];
+  return b + 2;
+}
+
+// Moves the only temporary (len bytes) into a block owned by var.
+static int str_assign(zx80_basic_t *vm, int var, size_t len) {
+  zx80_str_var_t *sv = find_str(vm, var);
+  if (!sv) {
+    if (vm->str_var_count >= ZX80_BASIC_MAX_STRINGS) {
+      return -1;
     }
-    s++;
-    zx80_int range = 0;
-    s = parse_expr(vm, s, &range);
+    sv = &vm->str_vars[vm->str_var_count++];
+    sv->var = var;
+    sv->offset = STR_NONE;
+  }
+  if (sv->offset != STR_NONE) {
+    vm->str_mem[sv->offset] = STR_DEAD;
+    sv->offset = STR_NONE;
+  }
+  if (str_reserve(vm, 2) != 0) {
+    return -1;
+  }
+  uint8_t *b = str_temp_at(vm, 0);
+  memmove(b + 2, b, len);
+  b[0] = (uint8_t)(sv - vm->str_vars);
+  b[1] = (uint8_t)len;
+  sv->offset = vm->str_mem_used;
+  vm->str_mem_used += 2 + len;
+  vm->str_temp = 0;
+  return 0;
+}
+
+static int is_str_start(const char *s) {
+  s = skip_ws(s);
+  if (*s == '"') {
+    return 1;
+  }
+  int idx = 0;
+  s = parse_var(s, &idx);
+  return s && *s == '$';
+}
+
+// Slices the temporary that starts at `start`: (n), (n TO m), ( TO m) and
+// (n TO ) count from 1 and include both ends; n > m gives "".
+static const char *parse_slice(zx80_basic_t *vm, const char *s, size_t start) {
+  zx80_int len = (zx80_int)(vm->str_temp - start);
+  zx80_int from = NUM_FROM_INT(1);
+  zx80_int to = NUM_FROM_INT(len);
+  s = skip_ws(s);
+  if (!is_tok(s, TOK_TO)) {
+    s = parse_expr(vm, s, &from);
     if (!s) {
       return NULL;
     }
     s = skip_ws(s);
+    to = from;
+  }
+  if (is_tok(s, TOK_TO)) {
+    to = NUM_FROM_INT(len);
+    s = skip_ws(s + 1);
     if (*s != ')') {
-      return NULL;
+      s = parse_expr(vm, s, &to);
+      if (!s) {
+        return NULL;
+      }
+      s = skip_ws(s);
     }
-    *out = rand_next(vm, range);
+  }
+  if (*s != ')') {
+    return NULL;
+  }
+  from = NUM_TO_INT(from);
+  to = NUM_TO_INT(to);
+  if (from > to) {
+    vm->str_temp = start;
     return s + 1;
   }
-  kw = match_kw(s, "PEEK");
-  if (kw) {
-    s = kw;
-    s = skip_ws(s);
-    if (*s != '(') {
+  if (from < 1 || to > len) {
+    if (!vm->eval_skip) {
       return NULL;
     }
-    s++;
-    zx80_int addr = 0;
-    s = parse_expr(vm, s, &addr);
-    if (!s) {
-      return NULL;
+    vm->str_temp = start;
+    return s + 1;
+  }
+  uint8_t *p = str_temp_at(vm, start);
+  memmove(p, p + from - 1, (size_t)(to - from + 1));
+  vm->str_temp = start + (size_t)(to - from + 1);
+  return s + 1;
+}
+
+static const char *parse_str_term(zx80_basic_t *vm, const char *s) {
+  s = skip_ws(s);
+  size_t start = vm->str_temp;
+  size_t n = 0;
+  if (*s == '"') {
+    const char *lit = ++s;
+    while (*s && *s != '"') {
+      s++;
     }
-    s = skip_ws(s);
-    if (*s != ')') {
+    n = (size_t)(s - lit);
+    if (str_reserve(vm, n) != 0) {
       return NULL;
     }
-    if (addr < 0 || (size_t)addr >= vm->ram_size) {
-      *out = 0;
-    } else {
-      *out = vm->ram[addr];
+    memcpy(str_temp_at(vm, start), lit, n);
+    if (*s == '"') {
+      s++;
     }
-    return s + 1;
-  }
-  if (is_name_char(*s)) {
+  } else {
     int idx = 0;
     s = parse_var(s, &idx);
-    if (!s) {
+    if (!s || *s != '$') {
       return NULL;
     }
-    const char *ns = skip_ws(s);
-    if (*ns == '(') {
-      zx80_int i = 0;
+    s++;
+    str_value(vm, idx, &n);
+    if (str_reserve(vm, n) != 0) {
+      return NULL;
+    }
+    const uint8_t *v = str_value(vm, idx, &n);
+    if (n > 0) {
+      memcpy(str_temp_at(vm, start), v, n);
+    }
+  }
+  vm->str_temp = start + n;
+  s = skip_ws(s);
+  if (*s == '(') {
+    return parse_slice(vm, s + 1, start);
+  }
+  return s;
+}
+
+// Evaluates a string expression onto the temporary stack: the result is the
+// *len bytes at str_temp_at(vm, *rel), popped by restoring str_temp.
+static const char *parse_str_expr(zx80_basic_t *vm, const char *s, size_t *rel,
+                                  size_t *len) {
+  size_t start = vm->str_temp;
+  while (1) {
+    s = parse_str_term(vm, s);
+    if (!s || vm->str_temp - start > STR_MAX) {
+      vm->str_temp = start;
+      return NULL;
+    }
+    s = skip_ws(s);
+    if (*s != '+') {
+      break;
+    }
+    s++;
+  }
+  *rel = start;
+  *len = vm->str_temp - start;
+  return s;
+}
+
+static const char *parse_str_compare(zx80_basic_t *vm, const char *s,
+                                     zx80_int *out) {
+  size_t mark = vm->str_temp;
+  size_t ra = 0;
+  size_t la = 0;
+  size_t rb = 0;
+  size_t lb = 0;
+  int op = REL_NONE;
+  s = parse_str_expr(vm, s, &ra, &la);
+  if (s) {
+    s = parse_relop(skip_ws(s), &op);
+  }
+  s = (s && op != REL_NONE) ? parse_str_expr(vm, s, &rb, &lb) : NULL;
+  if (s) {
+    int cmp = memcmp(str_temp_at(vm, ra), str_temp_at(vm, rb),
+                     la < lb ? la : lb);
+    if (cmp == 0) {
+      cmp = (la < lb) ? -1 : (la > lb);
+    }
+    *out = relop_holds(op, cmp) ? NUM_TRUE : 0;
+  }
+  vm->str_temp = mark;
+  return s;
+}
+
+static const char *parse_factor(zx80_basic_t *vm, const char *s,
+                                zx80_int *out) {
+  s = skip_ws(s);
+  if (*s == '(') {
+    s++;
+    s = parse_expr(vm, s, out);
+    if (!s) {
+      return NULL;
+    }
+    s = skip_ws(s);
+    if (*s != ')') {
+      return NULL;
+    }
+    return s + 1;
+  }
+  if (*s == '+' || *s == '-') {
+    char sign = *s++;
+    s = parse_factor(vm, s, out);
+    if (!s) {
+      return NULL;
+    }
+    if (sign == '-') {
+      *out = (zx80_int)(0u - (uint32_t)*out);
+    }
+    return s;
+  }
+  if (is_tok(s, TOK_RND)) {
+    s = skip_ws(s + 1);
+    if (*s != '(') {
+      return NULL;
+    }
+    s++;
+    zx80_int range = 0;
+    s = parse_expr(vm, s, &range);
+    if (!s) {
+      return NULL;
+    }
+    s = skip_ws(s);
+    if (*s != ')') {
+      return NULL;
+    }
+    *out = vm->eval_skip ? 0 : rand_next(vm, range);
+    return s + 1;
+  }
+  if (is_tok(s, TOK_PEEK)) {
+    s = skip_ws(s + 1);
+    if (*s != '(') {
+      return NULL;
+    }
+    s++;
+    zx80_int addr = 0;
+    s = parse_expr(vm, s, &addr);
+    if (!s) {
+      return NULL;
+    }
+    s = skip_ws(s);
+    if (*s != ')') {
+      return NULL;
+    }
+    addr = NUM_TO_INT(addr);
+    if (vm->eval_skip || addr < 0 || (size_t)addr >= vm->ram_size) {
+      *out = 0;
+    } else {
+      *out = NUM_FROM_INT(vm->ram[addr]);
+    }
+    return s + 1;
+  }
+  if (is_tok(s, TOK_USR)) {
+    return parse_usr(vm, s + 1, out);
+  }
+  if (is_tok(s, TOK_SUM)) {
+    s = skip_ws(s + 1);
+    if (*s != '(') {
+      return NULL;
+    }
+    zx80_array_t *arr = NULL;
+    s = parse_array_ref(vm, s + 1, &arr);
+    if (!s) {
+      return NULL;
+    }
+    s = skip_ws(s);
+    if (*s != ')') {
+      return NULL;
+    }
+    *out = 0;
+    if (!vm->eval_skip) {
+      size_t n = 0;
+      uint8_t *cells = array_cells(vm, arr, &n);
+      if (!cells) {
+        return NULL;
+      }
+      *out = array_sum(arr, cells, n);
+    }
+    return s + 1;
+  }
+  if (is_tok(s, TOK_LEN)) {
+    s = skip_ws(s + 1);
+    if (*s != '(') {
+      return NULL;
+    }
+    size_t mark = vm->str_temp;
+    size_t rel = 0;
+    size_t len = 0;
+    s = parse_str_expr(vm, s + 1, &rel, &len);
+    vm->str_temp = mark;
+    if (!s) {
+      return NULL;
+    }
+    s = skip_ws(s);
+    if (*s != ')') {
+      return NULL;
+    }
+    *out = NUM_FROM_INT(len);
+    return s + 1;
+  }
+  if (is_var_start(s)) {
+    int idx = 0;
+    s = parse_var(s, &idx);
+    if (!s || *s == '$') {
+      return NULL;
+    }
+    const char *ns = skip_ws(s);
+    if (*ns == '(') {
+      zx80_int i = 0;
       zx80_int j = 0;
       int dims = 0;
       ns = parse_indices(vm, ns, &i, &j, &dims);
       if (!ns) {
         return NULL;
       }
+      if (vm->eval_skip) {
+        *out = 0;
+        return ns;
+      }
       zx80_array_t *arr = find_array(vm, idx);
       if (!arr || arr->dims != dims) {
         return NULL;
       }
-      zx80_int *cell = array_at(vm, arr, i, j);
+      uint8_t *cell = array_at(vm, arr, i, j);
       if (!cell) {
         return NULL;
       }
-      *out = *cell;
+      *out = cell_load(arr, cell);
       return ns;
     }
     *out = vm->vars[idx];
     return s;
   }
-  return parse_int(s, out);
+  return parse_literal(s, out);
+}
+
+// Precedence climbing over binary_op(). The right operand of AND when the
+// left is 0, or of OR when it is true, cannot change the result: it is
+// parsed with vm->eval_skip set so RND, PEEK and array reads are not done.
+static const char *parse_climb(zx80_basic_t *vm, const char *s, int min_prec,
+                               zx80_int *out) {
+  s = skip_ws(s);
+  if (is_tok(s, TOK_NOT) && min_prec <= PREC_NOT) {
+    s = parse_climb(vm, s + 1, PREC_NOT, out);
+    if (s) {
+      *out = NUM_NOT(*out);
+    }
+  } else if (is_str_start(s)) {
+    s = parse_str_compare(vm, s, out);
+  } else {
+    s = parse_factor(vm, s, out);
+  }
+  while (s) {
+    int op = 0;
+    const char *ns = NULL;
+    int prec = binary_op(skip_ws(s), &op, &ns);
+    if (prec == 0 || prec < min_prec) {
+      break;
+    }
+    int skip = (op == TOK_AND && *out == 0) ||
+               (op == TOK_OR && *out == NUM_TRUE);
+    zx80_int rhs = 0;
+    vm->eval_skip += skip;
+    s = parse_climb(vm, ns, prec + 1, &rhs);
+    vm->eval_skip -= skip;
+    if (s && !skip) {
+      *out = apply_binary(op, *out, rhs);
+    }
+  }
+  return s;
+}
+
+static const char *parse_expr(zx80_basic_t *vm, const char *s, zx80_int *out) {
+  return parse_climb(vm, s, PREC_OR, out);
+}
+
+// The arena (vm->ram) is laid out like the ZX80 memory map, low to high:
+//   program [0, prog_end) | line index | arrays | FOR stack | GOSUB stack |
+//   free | interned names | variables
+// The low regions start ARENA_ALIGN aligned and are slid up or down as the
+// program, the array heap or a stack needs room; the names and variables grow
+// down from the top. Only the *_base offsets and the cached pointers change
+// on a move, so nothing else may keep pointers into the moved regions.
+#define ARENA_ALIGN 8
+#define STACK_CHUNK 4
+
+enum { REGION_INDEX, REGION_ARRAYS, REGION_FOR, REGION_GOSUB };
+
+static size_t arena_align(const zx80_basic_t *vm, size_t off) {
+  uintptr_t p = (uintptr_t)(vm->ram + off);
+  return off + (size_t)((0 - p) & (ARENA_ALIGN - 1));
+}
+
+static size_t arena_low_end(const zx80_basic_t *vm) {
+  return vm->gosub_base + (size_t)vm->gosub_cap * sizeof(const uint8_t *);
+}
+
+static size_t arena_free(const zx80_basic_t *vm) {
+  size_t end = arena_low_end(vm);
+  return (vm->names_base > end) ? vm->names_base - end : 0;
+}
+
+static void arena_update(zx80_basic_t *vm) {
+  vm->line_index = (uint16_t *)(vm->ram + vm->index_base);
+  vm->array_mem = vm->ram + vm->array_base;
+  vm->for_stack = (zx80_for_frame_t *)(vm->ram + vm->for_base);
+  vm->gosub_stack = (const uint8_t **)(vm->ram + vm->gosub_base);
+}
+
+// Slides region `first` and the ones above it by delta bytes (a multiple of
+// ARENA_ALIGN); fails when growing past the free space.
+static int arena_shift(zx80_basic_t *vm, int first, ptrdiff_t delta) {
+  size_t from = (first == REGION_INDEX)    ? vm->index_base
+                : (first == REGION_ARRAYS) ? vm->array_base
+                : (first == REGION_FOR)    ? vm->for_base
+                                           : vm->gosub_base;
+  if (delta > 0 && (size_t)delta > arena_free(vm)) {
+    return -1;
+  }
+  memmove(vm->ram + from + delta, vm->ram + from, arena_low_end(vm) - from);
+  if (first <= REGION_INDEX) {
+    vm->index_base += delta;
+  }
+  if (first <= REGION_ARRAYS) {
+    vm->array_base += delta;
+  }
+  if (first <= REGION_FOR) {
+    vm->for_base += delta;
+  }
+  vm->gosub_base += delta;
+  arena_update(vm);
+  return 0;
+}
+
+// Moves the regions above the program to follow a new prog_end.
+static int arena_rebase(zx80_basic_t *vm, size_t prog_end) {
+  size_t base = arena_align(vm, prog_end);
+  return arena_shift(vm, REGION_INDEX,
+                     (ptrdiff_t)base - (ptrdiff_t)vm->index_base);
+}
+
+// Empties everything but the names and variables; the program must be
+// empty too.
+static void arena_clear(zx80_basic_t *vm) {
+  vm->index_base = arena_align(vm, 0);
+  vm->line_count = 0;
+  vm->line_cap = 0;
+  vm->array_base = vm->index_base;
+  vm->gap_start = 0;
+  vm->gap_len = vm->index_base;
+  vm->gap_line = -1;
+  vm->array_mem_size = 0;
+  vm->array_mem_used = 0;
+  vm->for_base = vm->array_base;
+  vm->gosub_base = vm->array_base;
+  vm->for_sp = 0;
+  vm->for_cap = 0;
+  vm->gosub_sp = 0;
+  vm->gosub_cap = 0;
+  arena_update(vm);
+}
+
+// Drops the GOSUB and FOR frames and gives their space back.
+static void stacks_clear(zx80_basic_t *vm) {
+  vm->for_sp = 0;
+  vm->for_cap = 0;
+  vm->gosub_sp = 0;
+  vm->gosub_cap = 0;
+  vm->gosub_base = vm->for_base;
+  arena_update(vm);
+}
+
+static zx80_for_frame_t *for_push(zx80_basic_t *vm) {
+  if (vm->for_sp == vm->for_cap) {
+    if (arena_shift(vm, REGION_GOSUB,
+                    STACK_CHUNK * sizeof(zx80_for_frame_t)) != 0) {
+      return NULL;
+    }
+    vm->for_cap += STACK_CHUNK;
+  }
+  return &vm->for_stack[vm->for_sp++];
+}
+
+static int gosub_push(zx80_basic_t *vm, const uint8_t *ret) {
+  if (vm->gosub_sp == vm->gosub_cap) {
+    if (arena_free(vm) < STACK_CHUNK * sizeof(const uint8_t *)) {
+      return -1;
+    }
+    vm->gosub_cap += STACK_CHUNK;
+  }
+  vm->gosub_stack[vm->gosub_sp++] = ret;
+  return 0;
+}
+
+// Paged programs, run from an image in external storage:
+//   "ZXP1" | u32 line count | u32 names bytes | u32 lines bytes |
+//   names (as in the arena) | lines (stored format) | index
+// The index holds a {u16 line, u32 image offset} entry per line. Lines are
+// read into the cache a page at a time, from a line start and keeping only
+// whole lines, so straight-line code and loops run from RAM and only cold
+// jumps search the index. The walker keeps plain pointers into the pages,
+// so a page holding the running statement, the CONT point or a GOSUB or
+// FOR frame is never evicted.
+#define PAGE_HEADER 16
+#define PAGE_ENTRY 6
+
+// A page must hold the longest line, so every line can be read into one.
+_Static_assert(ZX80_BASIC_PAGE_SIZE >= ZX80_BASIC_LINE_MAX + 4,
+               "ZX80_BASIC_PAGE_SIZE below ZX80_BASIC_LINE_MAX + 4");
+
+static uint8_t *page_buf(zx80_basic_t *vm, int i) {
+  return vm->page_mem + (size_t)i * ZX80_BASIC_PAGE_SIZE;
+}
+
+// Index of the page holding p, or -1.
+static int page_of(zx80_basic_t *vm, const void *p) {
+  for (int i = 0; p && i < vm->page_count; ++i) {
+    const uint8_t *b = page_buf(vm, i);
+    if ((const uint8_t *)p >= b && (const uint8_t *)p < b + vm->pages[i].valid) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static uint32_t page_offset(zx80_basic_t *vm, const void *p) {
+  int i = page_of(vm, p);
+  return vm->pages[i].start + (uint32_t)((const uint8_t *)p - page_buf(vm, i));
+}
+
+static int page_pinned(zx80_basic_t *vm, int i) {
+  if (page_of(vm, vm->page_pc) == i || page_of(vm, vm->cont_ptr) == i ||
+      ((vm->run_state == ZX80_RUNNING ||
+        vm->run_state == ZX80_WAITING_INPUT) &&
+       page_of(vm, vm->run_pc) == i)) {
+    return 1;
+  }
+  for (int k = 0; k < vm->gosub_sp; ++k) {
+    if (page_of(vm, vm->gosub_stack[k]) == i) {
+      return 1;
+    }
+  }
+  for (int k = 0; k < vm->for_sp; ++k) {
+    if (page_of(vm, vm->for_stack[k].line_ptr) == i) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Returns the stored line at image offset off, reading a page on a miss;
+// NULL, with page_error set, when it cannot be read or every page is held.
+static const uint8_t *page_line(zx80_basic_t *vm, uint32_t off) {
+  for (int i = 0; i < vm->page_count; ++i) {
+    zx80_page_t *pg = &vm->pages[i];
+    if (off >= pg->start && off - pg->start < pg->valid) {
+      pg->stamp = ++vm->page_clock;
+      return page_buf(vm, i) + (off - pg->start);
+    }
+  }
+  int victim = -1;
+  for (int i = 0; i < vm->page_count; ++i) {
+    if (!page_pinned(vm, i) &&
+        (victim < 0 || vm->pages[i].stamp < vm->pages[victim].stamp)) {
+      victim = i;
+    }
+  }
+  if (victim < 0 || off < vm->page_first || off >= vm->page_index) {
+    vm->page_error = 1;
+    return NULL;
+  }
+  zx80_page_t *pg = &vm->pages[victim];
+  uint8_t *buf = page_buf(vm, victim);
+  size_t want = vm->page_index - off;
+  if (want > ZX80_BASIC_PAGE_SIZE) {
+    want = ZX80_BASIC_PAGE_SIZE;
+  }
+  size_t got = vm->pager.read(off, buf, want, vm->pager.user);
+  size_t valid = 0;
+  while (valid + 4 <= got) {
+    size_t len = read_u16(buf + valid + 2);
+    if (len == 0 || valid + 4 + len > got || buf[valid + 3 + len] != '\0') {
+      break;
+    }
+    valid += 4 + len;
+  }
+  pg->valid = (uint32_t)valid;
+  if (valid == 0) {
+    vm->page_error = 1;
+    return NULL;
+  }
+  pg->start = off;
+  pg->stamp = ++vm->page_clock;
+  return buf;
+}
+
+// Text of `line` (0xFFFF = first line) of the paged program, or NULL.
+static const char *page_find(zx80_basic_t *vm, uint16_t line) {
+  uint32_t off = vm->page_first;
+  if (line != 0xFFFF) {
+    for (int i = 0; i < vm->page_count; ++i) {
+      uint8_t *p = page_buf(vm, i);
+      uint8_t *end = p + vm->pages[i].valid;
+      for (; p < end && read_u16(p) <= line; p += 4 + read_u16(p + 2)) {
+        if (read_u16(p) == line) {
+          vm->pages[i].stamp = ++vm->page_clock;
+          return (const char *)(p + 4);
+        }
+      }
+    }
+    uint32_t lo = 0;
+    uint32_t hi = vm->page_lines;
+    for (;;) {
+      if (lo >= hi) {
+        return NULL;
+      }
+      uint32_t mid = lo + (hi - lo) / 2;
+      uint8_t e[PAGE_ENTRY];
+      if (vm->pager.read(vm->page_index + mid * PAGE_ENTRY, e, sizeof(e),
+                         vm->pager.user) != sizeof(e)) {
+        vm->page_error = 1;
+        return NULL;
+      }
+      uint16_t ln = read_u16(e);
+      if (ln == line) {
+        off = read_u32(e + 2);
+        break;
+      }
+      if (ln < line) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+  } else if (vm->page_lines == 0) {
+    return NULL;
+  }
+  const uint8_t *p = page_line(vm, off);
+  return p ? (const char *)(p + 4) : NULL;
+}
+
+static void page_close(zx80_basic_t *vm) {
+  vm->pager.read = NULL;
+  vm->page_count = 0;
+  vm->page_pc = NULL;
+}
+
+// Line at logical offset `off` of the program, also while the line-edit gap
+// (see below) is open.
+static uint8_t *prog_line(zx80_basic_t *vm, size_t off) {
+  return vm->ram + off + (off < vm->gap_start ? 0 : vm->gap_len);
+}
+
+// The line index holds the logical offset of every line, in line order, as
+// a u16, so the program is kept below PROG_MAX bytes. insert_line and
+// delete_line update it in place; it grows INDEX_CHUNK entries at a time.
+#define INDEX_CHUNK 16
+#define PROG_MAX 0xFFFF
+
+// Position of the first line numbered `line` or above, line_count if none.
+static size_t line_index_find(zx80_basic_t *vm, uint16_t line) {
+  size_t lo = 0;
+  size_t hi = vm->line_count;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (read_u16(prog_line(vm, vm->line_index[mid])) < line) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+// Gives the index room for `count` entries, in whole chunks; shrinking
+// cannot fail.
+static int line_index_fit(zx80_basic_t *vm, size_t count) {
+  size_t cap = align_up(count, INDEX_CHUNK);
+  if (cap != vm->line_cap &&
+      arena_shift(vm, REGION_ARRAYS,
+                  ((ptrdiff_t)cap - (ptrdiff_t)vm->line_cap) *
+                      (ptrdiff_t)sizeof(uint16_t)) != 0) {
+    return -1;
+  }
+  vm->line_cap = cap;
+  return 0;
+}
+
+// Indexes the whole program, e.g. after a restore.
+static int line_index_build(zx80_basic_t *vm) {
+  size_t count = 0;
+  for (size_t off = 0; off < vm->prog_end;
+       off += 4 + read_u16(prog_line(vm, off) + 2)) {
+    ++count;
+  }
+  if (line_index_fit(vm, count) != 0) {
+    return -1;
+  }
+  vm->line_count = 0;
+  for (size_t off = 0; off < vm->prog_end;
+       off += 4 + read_u16(prog_line(vm, off) + 2)) {
+    vm->line_index[vm->line_count++] = (uint16_t)off;
+  }
+  return 0;
+}
+
+// Adds the line just stored in `len` bytes at logical offset `off` as entry
+// `at`; the room was made by line_index_fit.
+static void line_index_insert(zx80_basic_t *vm, size_t at, size_t off,
+                              size_t len) {
+  uint16_t *index = vm->line_index;
+  memmove(index + at + 1, index + at,
+          (vm->line_count - at) * sizeof(uint16_t));
+  index[at] = (uint16_t)off;
+  vm->line_count++;
+  for (size_t i = at + 1; i < vm->line_count; ++i) {
+    index[i] = (uint16_t)(index[i] + len);
+  }
+}
+
+// Removes entry `at`, whose line is losing its `len` bytes.
+static void line_index_delete(zx80_basic_t *vm, size_t at, size_t len) {
+  uint16_t *index = vm->line_index;
+  vm->line_count--;
+  memmove(index + at, index + at + 1,
+          (vm->line_count - at) * sizeof(uint16_t));
+  for (size_t i = at; i < vm->line_count; ++i) {
+    index[i] = (uint16_t)(index[i] - len);
+  }
+}
+
+static uint8_t *find_line(zx80_basic_t *vm, uint16_t line) {
+  size_t at = line_index_find(vm, line);
+  if (at == vm->line_count) {
+    return NULL;
+  }
+  uint8_t *p = prog_line(vm, vm->line_index[at]);
+  return read_u16(p) == line ? p : NULL;
+}
+
+// Lines are edited in a gap buffer: the program is [0, gap_start) and
+// [gap_start + gap_len, index_base), the gap being every byte between them.
+// An edit first moves the gap to its line, so lines entered or loaded in
+// order move nothing and need no search. Everything else reads [0, prog_end)
+// and runs after program_close() has put the gap back at the end.
+#define GAP_CHUNK 64
+#define GAP_LINE_UNKNOWN 0x10000
+
+// Moves the gap to logical offset `at` (a line boundary).
+static void gap_move(zx80_basic_t *vm, size_t at) {
+  uint8_t *ram = vm->ram;
+  if (at < vm->gap_start) {
+    memmove(ram + at + vm->gap_len, ram + at, vm->gap_start - at);
+  } else if (at > vm->gap_start) {
+    memmove(ram + vm->gap_start, ram + vm->gap_start + vm->gap_len,
+            at - vm->gap_start);
+  }
+  vm->gap_start = at;
+}
+
+// Makes the program, gap included, end at `end` (>= prog_end) by moving the
+// line index, arrays and stacks, keeping the lines after the gap at its top.
+static int gap_resize(zx80_basic_t *vm, size_t end) {
+  size_t tail = vm->prog_end - vm->gap_start;
+  size_t old_base = vm->index_base;
+  size_t base = arena_align(vm, end);
+  if (base > old_base && arena_rebase(vm, end) != 0) {
+    return -1;
+  }
+  memmove(vm->ram + base - tail, vm->ram + old_base - tail, tail);
+  if (base < old_base) {
+    arena_rebase(vm, end);
+  }
+  vm->gap_len = base - vm->prog_end;
+  return 0;
+}
+
+// Finds the logical offset of `line`, or where it would go, its line index
+// entry and the number of the line before it (-1 if none). Fast when the
+// gap is already there.
+static size_t gap_locate(zx80_basic_t *vm, uint16_t line, int *found,
+                         int32_t *prev, size_t *at) {
+  *found = 0;
+  if (vm->gap_line < line) {
+    const uint8_t *after = vm->ram + vm->gap_start + vm->gap_len;
+    if (vm->gap_start >= vm->prog_end || read_u16(after) >= line) {
+      *found = vm->gap_start < vm->prog_end && read_u16(after) == line;
+      *prev = vm->gap_line;
+      *at = (vm->gap_start >= vm->prog_end) ? vm->line_count
+                                             : line_index_find(vm, line);
+      return vm->gap_start;
+    }
+  }
+  *at = line_index_find(vm, line);
+  *prev = *at ? read_u16(prog_line(vm, vm->line_index[*at - 1])) : -1;
+  if (*at == vm->line_count) {
+    return vm->prog_end;
+  }
+  *found = read_u16(prog_line(vm, vm->line_index[*at])) == line;
+  return vm->line_index[*at];
+}
+
+// Puts the gap back at the end of the program and returns its spare bytes
+// to the arena, so [0, prog_end) is the whole program.
+static void program_close(zx80_basic_t *vm) {
+  if (vm->gap_start != vm->prog_end) {
+    vm->gap_line = GAP_LINE_UNKNOWN;
+  }
+  gap_move(vm, vm->prog_end);
+  line_index_fit(vm, vm->line_count);
+  gap_resize(vm, vm->prog_end);
+}
+
+// Any edit ends a paged program and invalidates the compiled image and the
+// CONT point into it, and the GOSUB/FOR frames that point into either.
+static void program_changed(zx80_basic_t *vm) {
+  page_close(vm);
+  vm->run_state = ZX80_STOPPED;
+  vm->code_state = CODE_STALE;
+  vm->cont_ptr = NULL;
+  stacks_clear(vm);
+}
+
+static int delete_line(zx80_basic_t *vm, uint16_t line) {
+  int found = 0;
+  int32_t prev = -1;
+  size_t at = 0;
+  size_t off = gap_locate(vm, line, &found, &prev, &at);
+  if (!found) {
+    return 0;
+  }
+  program_changed(vm);
+  gap_move(vm, off);
+  vm->gap_line = prev;
+  size_t len = 4 + read_u16(vm->ram + off + vm->gap_len + 2);
+  line_index_delete(vm, at, len);
+  vm->gap_len += len;
+  vm->prog_end -= len;
+  return 1;
+}
+
+static int insert_line(zx80_basic_t *vm, uint16_t line, const uint8_t *text,
+                       size_t text_len) {
+  delete_line(vm, line);
+  size_t need = 4 + text_len;
+  program_changed(vm);
+  if (need > PROG_MAX - vm->prog_end ||
+      line_index_fit(vm, vm->line_count + 1) != 0) {
+    return -1;
+  }
+  int found = 0;
+  int32_t prev = -1;
+  size_t at = 0;
+  gap_move(vm, gap_locate(vm, line, &found, &prev, &at));
+  vm->gap_line = prev;
+  if (vm->gap_len < need &&
+      gap_resize(vm, vm->prog_end + need + GAP_CHUNK) != 0 &&
+      gap_resize(vm, vm->prog_end + need) != 0) {
+    return -1;
+  }
+  uint8_t *pos = vm->ram + vm->gap_start;
+  write_u16(pos, line);
+  write_u16(pos + 2, (uint16_t)text_len);
+  memcpy(pos + 4, text, text_len);
+  vm->gap_start += need;
+  vm->gap_len -= need;
+  vm->prog_end += need;
+  vm->gap_line = line;
+  line_index_insert(vm, at, vm->gap_start - need, need);
+  return 0;
+}
+
+static size_t names_end(zx80_basic_t *vm) {
+  return (size_t)((uint8_t *)vm->vars - vm->ram);
+}
+
+static void vars_clear(zx80_basic_t *vm) {
+  uintptr_t top = ((uintptr_t)(vm->ram + vm->ram_size)) & ~(uintptr_t)3;
+  vm->var_count = VAR_LETTERS;
+  vm->vars = (zx80_int *)top - VAR_LETTERS;
+  memset(vm->vars, 0, VAR_LETTERS * sizeof(zx80_int));
+  vm->names_base = names_end(vm);
+  for (int i = 0; i < vm->native_count; ++i) {
+    vm->natives[i].slot = -1;
+  }
+}
+
+// Returns the interned name of slot (>= VAR_LETTERS) and its length.
+static const uint8_t *var_name(zx80_basic_t *vm, int slot, size_t *len) {
+  const uint8_t *p = vm->ram + vm->names_base;
+  for (int i = VAR_LETTERS; i < slot; ++i) {
+    p += 1 + p[0];
+  }
+  *len = p[0];
+  return p + 1;
+}
+
+// Finds or creates the slot for a multi-letter name. A new slot moves the
+// names and variables down to make room; returns -1 when out of space.
+static int intern_var(zx80_basic_t *vm, const char *name, size_t len) {
+  const uint8_t *p = vm->ram + vm->names_base;
+  for (int slot = VAR_LETTERS; slot < vm->var_count; ++slot) {
+    size_t n = p[0];
+    if (n == len) {
+      size_t i = 0;
+      while (i < n && p[1 + i] == toupper((unsigned char)name[i])) {
+        i++;
+      }
+      if (i == n) {
+        return slot;
+      }
+    }
+    p += 1 + n;
+  }
+  size_t need = sizeof(zx80_int) + 1 + len;
+  if (vm->var_count >= VAR_SLOTS_MAX || len > 0xFF ||
+      vm->names_base < arena_low_end(vm) + need) {
+    return -1;
+  }
+  size_t names_len = names_end(vm) - vm->names_base;
+  uint8_t *names = vm->ram + vm->names_base;
+  memmove(names - need, names, names_len);
+  vm->names_base -= need;
+  memmove(vm->vars - 1, vm->vars, (size_t)vm->var_count * sizeof(zx80_int));
+  vm->vars--;
+  uint8_t *entry = vm->ram + vm->names_base + names_len;
+  entry[0] = (uint8_t)len;
+  for (size_t i = 0; i < len; ++i) {
+    entry[1 + i] = (uint8_t)toupper((unsigned char)name[i]);
+  }
+  vm->vars[vm->var_count] = 0;
+  return vm->var_count++;
+}
+
+// Forgets the names interned from slot `first` on, newest first, while
+// nothing holds on to them: a direct command or a line that was not stored
+// must not use up slots. A name stays, with every name before it, once it
+// has a value, an array or a string, or a waiting INPUT assigns it.
+static void names_trim(zx80_basic_t *vm, int first) {
+  while (vm->var_count > first && vm->var_count > VAR_LETTERS) {
+    int slot = vm->var_count - 1;
+    if (vm->vars[slot] != 0 || vm->array_of[slot] || find_str(vm, slot) ||
+        (vm->run_state == ZX80_WAITING_INPUT && vm->input_var == slot)) {
+      return;
+    }
+    size_t len = 0;
+    var_name(vm, slot, &len);
+    size_t need = sizeof(zx80_int) + 1 + len;
+    size_t names_len = names_end(vm) - vm->names_base;
+    memmove(vm->vars + 1, vm->vars, (size_t)slot * sizeof(zx80_int));
+    vm->vars++;
+    uint8_t *names = vm->ram + vm->names_base;
+    memmove(names + need, names, names_len - 1 - len);
+    vm->names_base += need;
+    vm->var_count--;
+    for (int i = 0; i < vm->native_count; ++i) {
+      if (vm->natives[i].slot == slot) {
+        vm->natives[i].slot = -1;
+      }
+    }
+  }
+}
+
+// Finds the native registered under the name of variable slot `slot`. The
+// slot is remembered, so after the first call this is a compare per entry.
+static zx80_native_t *native_find(zx80_basic_t *vm, int slot) {
+  for (int i = 0; i < vm->native_count; ++i) {
+    if (vm->natives[i].slot == slot) {
+      return &vm->natives[i];
+    }
+  }
+  char letter = (char)('A' + slot);
+  const uint8_t *name = (const uint8_t *)&letter;
+  size_t len = 1;
+  if (slot >= VAR_LETTERS) {
+    name = var_name(vm, slot, &len);
+  }
+  for (int i = 0; i < vm->native_count; ++i) {
+    zx80_native_t *n = &vm->natives[i];
+    const char *q = n->name;
+    size_t k = 0;
+    while (k < len && q[k] && toupper((unsigned char)q[k]) == name[k]) {
+      k++;
+    }
+    if (n->slot < 0 && k == len && q[k] == '\0') {
+      n->slot = slot;
+      return n;
+    }
+  }
+  return NULL;
+}
+
+// Calls the native named by slot with argc values; bit i of `arrays` marks
+// vals[i] as the variable slot of an array passed whole.
+static int native_call(zx80_basic_t *vm, int slot, const zx80_int *vals,
+                       int argc, unsigned arrays, zx80_int *result) {
+  zx80_native_t *n = native_find(vm, slot);
+  if (!n) {
+    return -1;
+  }
+  zx80_native_arg_t args[ZX80_BASIC_NATIVE_ARGS];
+  for (int i = 0; i < argc; ++i) {
+    zx80_native_arg_t *arg = &args[i];
+    memset(arg, 0, sizeof(*arg));
+    arg->value = vals[i];
+    if (arrays & (1u << i)) {
+      zx80_array_t *arr = find_array(vm, vals[i]);
+      uint8_t *cells = array_cells(vm, arr, &arg->count);
+      if (!cells) {
+        return -1;
+      }
+      arg->value = 0;
+      if (arr->shift == ARRAY_BYTE) {
+        arg->bytes = cells;
+      } else if (arr->shift == ARRAY_WORD) {
+        arg->words = (int16_t *)cells;
+      } else {
+        arg->cells = (zx80_int *)cells;
+      }
+    }
+  }
+  *result = 0;
+  return n->fn(args, argc, result, n->user) ? -1 : 0;
+}
+
+// Argument list of USR NAME(...): A() passes array A whole, anything else
+// is an expression. Sets *arrays as for native_call().
+static const char *parse_usr_args(zx80_basic_t *vm, const char *s,
+                                  zx80_int *vals, int *argc,
+                                  unsigned *arrays) {
+  *argc = 0;
+  *arrays = 0;
+  s = skip_ws(s);
+  if (*s != '(') {
+    return s;
+  }
+  s = skip_ws(s + 1);
+  if (*s == ')') {
+    return s + 1;
+  }
+  while (1) {
+    if (*argc >= ZX80_BASIC_NATIVE_ARGS) {
+      return NULL;
+    }
+    int idx = 0;
+    const char *q = is_var_start(s) ? parse_var(s, &idx) : NULL;
+    if (q && *q == '(' && *skip_ws(q + 1) == ')') {
+      vals[*argc] = idx;
+      *arrays |= 1u << *argc;
+      s = skip_ws(q + 1) + 1;
+    } else {
+      s = parse_expr(vm, s, &vals[*argc]);
+      if (!s) {
+        return NULL;
+      }
+    }
+    (*argc)++;
+    s = skip_ws(s);
+    if (*s == ')') {
+      return s + 1;
+    }
+    if (*s != ',') {
+      return NULL;
+    }
+    s = skip_ws(s + 1);
+  }
+}
+
+// USR NAME[(args)] after the USR token. Under eval_skip only the arguments
+// are parsed.
+static const char *parse_usr(zx80_basic_t *vm, const char *s, zx80_int *out) {
+  int slot = 0;
+  s = parse_var(skip_ws(s), &slot);
+  if (!s || *s == '$') {
+    return NULL;
+  }
+  zx80_int vals[ZX80_BASIC_NATIVE_ARGS];
+  int argc = 0;
+  unsigned arrays = 0;
+  s = parse_usr_args(vm, s, vals, &argc, &arrays);
+  if (!s) {
+    return NULL;
+  }
+  *out = 0;
+  if (!vm->eval_skip &&
+      native_call(vm, slot, vals, argc, arrays, out) != 0) {
+    return NULL;
+  }
+  return s;
+}
+
+static uint8_t *emit_number(uint8_t *o, uint32_t v) {
+  if (v <= 0xFF) {
+    *o++ = TOK_NUM8;
+    *o++ = (uint8_t)v;
+  } else if (v <= 0xFFFF) {
+    *o++ = TOK_NUM16;
+    write_u16(o, (uint16_t)v);
+    o += 2;
+  } else {
+    *o++ = TOK_NUM32;
+    write_u32(o, v);
+    o += 4;
+  }
+  return o;
+}
+
+static int match_keyword(const char *s, const char **out_end) {
+  for (int t = 0; t < TOK_LAST - TOK_FIRST; ++t) {
+    const char *kw = match_kw(s, keywords[t].name);
+    if (kw) {
+      *out_end = kw;
+      return TOK_FIRST + t;
+    }
+  }
+  for (size_t a = 0; a < sizeof(keyword_aliases) / sizeof(keyword_aliases[0]);
+       ++a) {
+    const char *kw = match_kw(s, keyword_aliases[a].name);
+    if (kw) {
+      *out_end = kw;
+      return keyword_aliases[a].token;
+    }
+  }
+  return -1;
+}
+
+// Crunches source text into the stored line format: keywords become tokens,
+// literals become binary numbers, long variable names become slots and blanks
+// outside strings are dropped. The output is NUL terminated and *out_len
+// includes the terminator.
+static int crunch_line(zx80_basic_t *vm, const char *src, uint8_t *out,
+                       size_t max_len, size_t *out_len) {
+  uint8_t *o = out;
+  uint8_t *end = out + max_len - 1;
+  int in_word = 0;
+  const char *s = src;
+  while (*s) {
+    unsigned char c = (unsigned char)*s;
+    if (end - o < 5) {
+      return -1;
+    }
+    if (c == '"') {
+      *o++ = (uint8_t)*s++;
+      while (*s && *s != '"') {
+        if (o >= end) {
+          return -1;
+        }
+        *o++ = (uint8_t)*s++;
+      }
+      if (*s == '"') {
+        if (o >= end) {
+          return -1;
+        }
+        *o++ = (uint8_t)*s++;
+      }
+      in_word = 0;
+      continue;
+    }
+    if (isspace(c)) {
+      s++;
+      in_word = 0;
+      continue;
+    }
+    if (c < 0x20 || c >= 0x80) {
+      return -1;
+    }
+    if (!in_word && is_name_char((char)c)) {
+      const char *kw_end = NULL;
+      int tok = match_keyword(s, &kw_end);
+      if (tok >= 0) {
+        *o++ = (uint8_t)tok;
+        s = kw_end;
+        if (tok == TOK_REM) {
+          s = skip_ws(s);
+          while (*s) {
+            if (o >= end) {
+              return -1;
+            }
+            *o++ = (uint8_t)*s++;
+          }
+          break;
+        }
+        continue;
+      }
+      const char *name = s;
+      while (is_name_char(*s) || isdigit((unsigned char)*s)) {
+        s++;
+      }
+      if (s - name > 1) {
+        int slot = intern_var(vm, name, (size_t)(s - name));
+        if (slot < 0) {
+          return -1;
+        }
+        *o++ = TOK_VAR;
+        *o++ = (uint8_t)slot;
+        continue;
+      }
+      s = name;
+    }
+#if ZX80_BASIC_FIXED
+    if (!in_word && (isdigit(c) || (c == '.' && isdigit((unsigned char)s[1])))) {
+      const char *q = s;
+      while (isdigit((unsigned char)*q)) {
+        q++;
+      }
+      if (*q == '.') {
+        zx80_int v = 0;
+        s = parse_fixed(s, &v);
+        *o++ = TOK_FIX;
+        write_u32(o, (uint32_t)v);
+        o += 4;
+        continue;
+      }
+    }
+#endif
+    if (!in_word && isdigit(c)) {
+      uint32_t v = 0;
+      while (isdigit((unsigned char)*s)) {
+        v = (v * 10u) + (uint32_t)(*s - '0');
+        s++;
+      }
+      o = emit_number(o, v);
+      continue;
+    }
+    *o++ = c;
+    s++;
+    in_word = is_name_char((char)c) || isdigit(c);
+  }
+  *o++ = '\0';
+  *out_len = (size_t)(o - out);
+  return 0;
+}
+
+static void list_line(zx80_basic_t *vm, const uint8_t *p) {
+  write_int(vm, read_u16(p));
+  write_char(vm, ' ');
+  const char *t = (const char *)(p + 4);
+  char prev = ' ';
+  while (*t) {
+    uint8_t c = (uint8_t)*t;
+    if (c == '"') {
+      const char *q = t + 1;
+      while (*q && *q != '"') {
+        q++;
+      }
+      if (*q == '"') {
+        q++;
+      }
+      write_mem(vm, t, (size_t)(q - t));
+      t = q;
+      prev = '"';
+      continue;
+    }
+    zx80_int v = 0;
+    const char *nt = parse_num(t, &v);
+    if (nt) {
+      write_int(vm, v);
+      prev = '0';
+      t = nt;
+      continue;
+    }
+    if (c == TOK_FIX) {
+      write_num(vm, (zx80_int)read_u32((const uint8_t *)t + 1));
+      t += 5;
+      prev = '0';
+      continue;
+    }
+    if (c == TOK_VAR) {
+      size_t n = 0;
+      const uint8_t *name = var_name(vm, (uint8_t)t[1], &n);
+      write_mem(vm, (const char *)name, n);
+      prev = 'A';
+      t += 2;
+      continue;
+    }
+    if (c >= TOK_FIRST && c < TOK_LAST) {
+      const keyword_t *kw = &keywords[c - TOK_FIRST];
+      if ((kw->flags & KW_LEAD) && prev != ' ') {
+        write_char(vm, ' ');
+      }
+      write_str(vm, kw->name);
+      prev = 'A';
+      t++;
+      if ((kw->flags & KW_TRAIL) && *t) {
+        write_char(vm, ' ');
+        prev = ' ';
+      }
+      if (c == TOK_REM) {
+        write_str(vm, t);
+        break;
+      }
+      continue;
+    }
+    write_char(vm, *t++);
+    prev = (char)c;
+  }
+  write_newline(vm);
+}
+
+static void list_program(zx80_basic_t *vm) {
+  if (vm->pager.read) {
+    uint32_t off = vm->page_first;
+    const uint8_t *p = NULL;
+    while (off < vm->page_index && (p = page_line(vm, off)) != NULL) {
+      list_line(vm, p);
+      off += 4 + read_u16(p + 2);
+    }
+    return;
+  }
+  for (const uint8_t *p = vm->ram; p < vm->ram + vm->prog_end;
+       p += 4 + read_u16(p + 2)) {
+    list_line(vm, p);
+  }
+}
+
+static void handle_error(zx80_basic_t *vm, const char *msg) {
+  write_str(vm, msg);
+  write_newline(vm);
+}
+
+// next_stmt is the text of the statement after this one (NULL in direct
+// mode) and resume where the running engine goes on with it: next_stmt for
+// the walker, the code after the OP_EXEC for the bytecode engine. GOSUB,
+// FOR, STOP and INPUT record resume; jump_ptr is a resume point to go to,
+// such as a RETURN address.
+typedef struct {
+  const char *next_stmt;
+  const uint8_t *resume;
+  const uint8_t *jump_ptr;
+  uint16_t jump_line;
+  int stop;
+  int skip_line;
+} exec_ctx_t;
+
+static int exec_statement(zx80_basic_t *vm, const char *s, exec_ctx_t *ctx);
+
+static int exec_print(zx80_basic_t *vm, const char *s, exec_ctx_t *ctx) {
+  (void)ctx;
+  s = skip_ws(s);
+  if (is_stmt_end(s)) {
+    write_newline(vm);
+    return 0;
+  }
+  int suppress_nl = 0;
+  while (!is_stmt_end(s)) {
+    s = skip_ws(s);
+    suppress_nl = 0;
+    const char *ns = NULL;
+    if (is_str_start(s)) {
+      size_t mark = vm->str_temp;
+      size_t rel = 0;
+      size_t len = 0;
+      int op = REL_NONE;
+      ns = parse_str_expr(vm, s, &rel, &len);
+      if (ns) {
+        parse_relop(skip_ws(ns), &op);
+      }
+      if (ns && op == REL_NONE) {
+        write_mem(vm, (const char *)str_temp_at(vm, rel), len);
+      } else {
+        ns = NULL;
+      }
+      vm->str_temp = mark;
+    }
+    if (ns) {
+      s = ns;
+    } else {
+      zx80_int v = 0;
+      ns = parse_expr(vm, s, &v);
+      if (!ns) {
+        return -1;
+      }
+      write_num(vm, v);
+      s = ns;
+    }
+    s = skip_ws(s);
+    if (*s == ';') {
+      suppress_nl = 1;
+      s++;
+      continue;
+    }
+    if (*s == ',') {
+      write_char(vm, ' ');
+      s++;
+      continue;
+    }
+    break;
+  }
+  if (!suppress_nl) {
+    write_newline(vm);
+  }
+  return 0;
+}
+
+static int exec_let(zx80_basic_t *vm, const char *s, exec_ctx_t *ctx) {
+  (void)ctx;
+  int idx = 0;
+  s = parse_var(s, &idx);
+  if (!s) {
+    return -1;
+  }
+  if (*s == '$') {
+    s = skip_ws(s + 1);
+    if (*s != '=') {
+      return -1;
+    }
+    size_t rel = 0;
+    size_t len = 0;
+    if (!parse_str_expr(vm, s + 1, &rel, &len)) {
+      return -1;
+    }
+    return str_assign(vm, idx, len);
+  }
+  s = skip_ws(s);
+  zx80_int i = 0;
+  zx80_int j = 0;
+  int dims = 0;
+  int is_array = 0;
+  if (*s == '(') {
+    s = parse_indices(vm, s, &i, &j, &dims);
+    if (!s) {
+      return -1;
+    }
+    is_array = 1;
+    s = skip_ws(s);
+  }
+  if (*s != '=') {
+    return -1;
+  }
+  s++;
+  zx80_int v = 0;
+  s = parse_expr(vm, s, &v);
+  if (!s) {
+    return -1;
+  }
+  if (!is_array) {
+    vm->vars[idx] = v;
+    return 0;
+  }
+  zx80_array_t *arr = find_array(vm, idx);
+  if (!arr || arr->dims != dims) {
+    return -1;
+  }
+  uint8_t *cell = array_at(vm, arr, i, j);
+  if (!cell) {
+    return -1;
+  }
+  cell_store(arr, cell, v);
+  return 0;
+}
+
+// Stores a line of input in the INPUT target: the whole line for a string,
+// else its number (0 if it has none).
+static int input_assign(zx80_basic_t *vm, int idx, int is_str,
+                        const char *text) {
+  if (is_str) {
+    size_t n = strlen(text);
+    if (n > 0xFF) {
+      n = 0xFF;
+    }
+    if (str_reserve(vm, n) != 0) {
+      return -1;
+    }
+    memcpy(str_temp_at(vm, 0), text, n);
+    return str_assign(vm, idx, n);
+  }
+  zx80_int v = 0;
+#if ZX80_BASIC_FIXED
+  if (!parse_fixed(text, &v)) {
+    v = 0;
+  }
+#else
+  if (!parse_int(text, &v)) {
+    v = 0;
+  }
+#endif
+  vm->vars[idx] = v;
+  return 0;
+}
+
+// Without a read_line callback INPUT does not block: it stops the program
+// in state ZX80_WAITING_INPUT with the target in input_var/input_str and
+// where to go on in run_pc, and zx80_basic_handle_line takes the next line
+// as the value.
+static int exec_input(zx80_basic_t *vm, const char *s, exec_ctx_t *ctx) {
+  int idx = 0;
+  s = parse_var(s, &idx);
+  if (!s) {
+    return -1;
+  }
+  write_str(vm, "? ");
+  out_flush(vm);
+  if (!vm->io.read_line) {
+    vm->input_var = idx;
+    vm->input_str = (*s == '$');
+    vm->run_pc = ctx->resume;
+    vm->run_state = ZX80_WAITING_INPUT;
+    ctx->stop = 1;
+    return 0;
+  }
+  char buf[64];
+  int len = vm->io.read_line(buf, sizeof(buf), vm->io.user);
+  if (len <= 0) {
+    return -1;
+  }
+  buf[sizeof(buf) - 1] = '\0';
+  return input_assign(vm, idx, *s == '$', buf);
+}
+
+static int exec_if(zx80_basic_t *vm, const char *s, exec_ctx_t *ctx) {
+  zx80_int cond = 0;
+  s = parse_expr(vm, s, &cond);
+  if (!s) {
+    return -1;
+  }
+  s = skip_ws(s);
+  if (!is_tok(s, TOK_THEN)) {
+    return -1;
+  }
+  s = skip_ws(s + 1);
+  if (cond == 0) {
+    ctx->skip_line = 1;
+    return 0;
+  }
+  zx80_int line = 0;
+  if (parse_num(s, &line)) {
+    if (!parse_line_num(s, &ctx->jump_line)) {
+      return -1;
+    }
+    return 0;
+  }
+  return exec_statement(vm, s, ctx);
+}
+
+static int exec_rem(zx80_basic_t *vm, const char *s, exec_ctx_t *ctx) {
+  (void)vm;
+  (void)s;
+  (void)ctx;
+  return 0;
+}
+
+// GOTO and GOSUB take any expression as target, as on the real ZX80.
+static const char *parse_target(zx80_basic_t *vm, const char *s,
+                                uint16_t *out) {
+  zx80_int line = 0;
+  s = parse_expr(vm, s, &line);
+  line = NUM_TO_INT(line);
+  if (!s || line < 0 || line > 65535) {
+    return NULL;
+  }
+  *out = (uint16_t)line;
+  return s;
+}
+
+static int exec_goto(zx80_basic_t *vm, const char *s, exec_ctx_t *ctx) {
+  if (!parse_target(vm, s, &ctx->jump_line)) {
+    return -1;
+  }
+  return 0;
+}
+
+static int exec_end(zx80_basic_t *vm, const char *s, exec_ctx_t *ctx) {
+  (void)s;
+  ctx->stop = 1;
+  vm->cont_ptr = NULL;
+  return 0;
+}
+
+static int exec_stop(zx80_basic_t *vm, const char *s, exec_ctx_t *ctx) {
+  (void)s;
+  ctx->stop = 1;
+  if (ctx->resume) {
+    vm->cont_ptr = ctx->resume;
+  }
+  return 0;
+}
+
+static int exec_run(zx80_basic_t *vm, const char *s, exec_ctx_t *ctx) {
+  (void)vm;
+  s = skip_ws(s);
+  if (!is_stmt_end(s)) {
+    if (!parse_line_num(s, &ctx->jump_line)) {
+      return -1;
+    }
+  } else {
+    ctx->jump_line = 0xFFFF;
+  }
+  return 1;
+}
+
+static int exec_list(zx80_basic_t *vm, const char *s, exec_ctx_t *ctx) {
+  (void)s;
+  (void)ctx;
+  list_program(vm);
+  return 0;
+}
+
+static int exec_new(zx80_basic_t *vm, const char *s, exec_ctx_t *ctx) {
+  (void)s;
+  (void)ctx;
+  zx80_basic_reset(vm);
+  return 0;
+}
+
+static int exec_cls(zx80_basic_t *vm, const char *s, exec_ctx_t *ctx) {
+  (void)s;
+  (void)ctx;
+  for (int i = 0; i < 8; ++i) {
+    write_newline(vm);
+  }
+  return 0;
+}
+
+static int exec_fast(zx80_basic_t *vm, const char *s, exec_ctx_t *ctx) {
+  (void)s;
+  (void)ctx;
+  set_fast(vm, 1);
+  return 0;
+}
+
+static int exec_slow(zx80_basic_t *vm, const char *s, exec_ctx_t *ctx) {
+  (void)s;
+  (void)ctx;
+  set_fast(vm, 0);
+  return 0;
+}
+
+static int exec_cont(zx80_basic_t *vm, const char *s, exec_ctx_t *ctx) {
+  (void)s;
+  if (!vm->cont_ptr) {
+    return -1;
+  }
+  ctx->jump_ptr = vm->cont_ptr;
+  return 0;
+}
+
+static int exec_gosub(zx80_basic_t *vm, const char *s, exec_ctx_t *ctx) {
+  if (!ctx->next_stmt) {
+    return -1;
+  }
+  uint16_t line = 0;
+  if (!parse_target(vm, s, &line)) {
+    return -1;
+  }
+  if (gosub_push(vm, ctx->resume) != 0) {
+    return -1;
+  }
+  ctx->jump_line = line;
+  return 0;
+}
+
+static int exec_return(zx80_basic_t *vm, const char *s, exec_ctx_t *ctx) {
+  (void)s;
+  if (vm->gosub_sp <= 0) {
+    return -1;
+  }
+  ctx->jump_ptr = vm->gosub_stack[--vm->gosub_sp];
+  return 0;
+}
+
+// Text of the line after the one whose terminator is at nul, or NULL.
+static const char *next_line_text(zx80_basic_t *vm, const char *nul) {
+  if (vm->pager.read) {
+    uint32_t off = page_offset(vm, nul) + 1;
+    const uint8_t *p = (off < vm->page_index) ? page_line(vm, off) : NULL;
+    return p ? (const char *)(p + 4) : NULL;
+  }
+  const uint8_t *next = (const uint8_t *)nul + 1;
+  if (next >= vm->ram + vm->prog_end) {
+    return NULL;
+  }
+  return (const char *)(next + 4);
+}
+
+// Finds the NEXT statement that closes a FOR on idx, scanning statement
+// starts forward from `from`. Returns NULL when there is none.
+static const char *find_for_exit(zx80_basic_t *vm, const char *from,
+                                 int idx) {
+  const char *scan = from;
+  int depth = 0;
+  while (scan) {
+    if (*scan == '\0') {
+      scan = next_line_text(vm, scan);
+      continue;
+    }
+    const char *ts = skip_ws(scan);
+    if (is_tok(ts, TOK_FOR)) {
+      depth++;
+    } else if (is_tok(ts, TOK_NEXT)) {
+      ts = skip_ws(ts + 1);
+      int nidx = -1;
+      if (!is_stmt_end(ts) && !parse_var(ts, &nidx)) {
+        return NULL;
+      }
+      if (depth == 0 && (nidx < 0 || nidx == idx)) {
+        return scan;
+      }
+      if (depth > 0) {
+        depth--;
+      }
+    }
+    scan = stmt_next(scan);
+  }
+  return NULL;
+}
+
+static int exec_for(zx80_basic_t *vm, const char *s, exec_ctx_t *ctx) {
+  if (!ctx->next_stmt) {
+    return -1;
+  }
+  int idx = 0;
+  s = parse_var(s, &idx);
+  if (!s) {
+    return -1;
+  }
+  s = skip_ws(s);
+  if (*s != '=') {
+    return -1;
+  }
+  s++;
+  zx80_int start = 0;
+  s = parse_expr(vm, s, &start);
+  if (!s) {
+    return -1;
+  }
+  s = skip_ws(s);
+  if (!is_tok(s, TOK_TO)) {
+    return -1;
+  }
+  s++;
+  zx80_int end = 0;
+  s = parse_expr(vm, s, &end);
+  if (!s) {
+    return -1;
+  }
+  zx80_int step = NUM_FROM_INT(1);
+  s = skip_ws(s);
+  if (is_tok(s, TOK_STEP)) {
+    s = parse_expr(vm, s + 1, &step);
+    if (!s) {
+      return -1;
+    }
+  }
+  vm->vars[idx] = start;
+  int run = (step >= 0) ? (start <= end) : (start >= end);
+  if (!run) {
+    const char *next = find_for_exit(vm, ctx->next_stmt, idx);
+    if (!next) {
+      return -1;
+    }
+    ctx->jump_ptr = (const uint8_t *)stmt_next(next);
+    return 0;
+  }
+  zx80_for_frame_t *frame = for_push(vm);
+  if (!frame) {
+    return -1;
+  }
+  frame->var = idx;
+  frame->end = end;
+  frame->step = step;
+  frame->line_ptr = ctx->resume;
+  return 0;
+}
+
+static int exec_next(zx80_basic_t *vm, const char *s, exec_ctx_t *ctx) {
+  if (vm->for_sp <= 0) {
+    return -1;
+  }
+  s = skip_ws(s);
+  int idx = -1;
+  if (!is_stmt_end(s)) {
+    s = parse_var(s, &idx);
+    if (!s) {
+      return -1;
+    }
+  }
+  zx80_for_frame_t *frame = &vm->for_stack[vm->for_sp - 1];
+  if (idx >= 0 && frame->var != idx) {
+    return -1;
+  }
+  vm->vars[frame->var] += frame->step;
+  zx80_int v = vm->vars[frame->var];
+  int cont = (frame->step >= 0) ? (v <= frame->end) : (v >= frame->end);
+  if (cont) {
+    ctx->jump_ptr = frame->line_ptr;
+  } else {
+    vm->for_sp--;
+  }
+  return 0;
+}
+
+// POKE reaches only plain data, array cells and variable values, as the
+// rest of the arena holds tokens, names and frames with native pointers.
+static void poke(zx80_basic_t *vm, zx80_int addr, zx80_int value) {
+  size_t at = (size_t)addr;
+  size_t arrays = (size_t)(vm->array_mem - vm->ram);
+  size_t vars = (size_t)((uint8_t *)vm->vars - vm->ram);
+  if (addr < 0 ||
+      !((at >= arrays && at < arrays + vm->array_mem_used) ||
+        (at >= vars && at < vars + (size_t)vm->var_count * sizeof(zx80_int)))) {
+    return;
+  }
+  vm->ram[at] = (uint8_t)(value & 0xFF);
+}
+
+static int exec_poke(zx80_basic_t *vm, const char *s, exec_ctx_t *ctx) {
+  (void)ctx;
+  zx80_int addr = 0;
+  s = parse_expr(vm, s, &addr);
+  if (!s) {
+    return -1;
+  }
+  s = skip_ws(s);
+  if (*s != ',') {
+    return -1;
+  }
+  s++;
+  zx80_int value = 0;
+  s = parse_expr(vm, s, &value);
+  if (!s) {
+    return -1;
+  }
+  poke(vm, NUM_TO_INT(addr), NUM_TO_INT(value));
+  return 0;
+}
+
+static int exec_rand(zx80_basic_t *vm, const char *s, exec_ctx_t *ctx) {
+  (void)ctx;
+  s = skip_ws(s);
+  if (!is_stmt_end(s)) {
+    zx80_int seed = 0;
+    s = parse_expr(vm, s, &seed);
+    if (!s) {
+      return -1;
+    }
+    vm->rand_state = (uint32_t)NUM_TO_INT(seed);
+  } else {
+    vm->rand_state = (uint32_t)(vm->prog_end + 1);
+  }
+  return 0;
+}
+
+// Slides the live arrays down over the space of freed or resized ones and
+// hands the space left over back to the arena.
+static void array_compact(zx80_basic_t *vm) {
+  size_t used = 0;
+  while (1) {
+    zx80_array_t *next = NULL;
+    for (int i = 0; i < vm->array_count; ++i) {
+      zx80_array_t *arr = &vm->arrays[i];
+      if (arr->bytes && arr->offset >= used &&
+          (!next || arr->offset < next->offset)) {
+        next = arr;
+      }
+    }
+    if (!next) {
+      break;
+    }
+    if (next->offset != used) {
+      memmove(vm->array_mem + used, vm->array_mem + next->offset, next->bytes);
+      next->offset = used;
+    }
+    used += next->bytes;
+  }
+  vm->array_mem_used = used;
+  size_t size = align_up(used, ARENA_ALIGN);
+  arena_shift(vm, REGION_FOR, (ptrdiff_t)size - (ptrdiff_t)vm->array_mem_size);
+  vm->array_mem_size = size;
+}
+
+// Gives arr `need` bytes: in place when it is the last block, otherwise at
+// the end of the heap, compacting first and then growing the heap into the
+// arena when that does not fit.
+static int array_alloc(zx80_basic_t *vm, zx80_array_t *arr, size_t need) {
+  if (arr->bytes && arr->offset + arr->bytes == vm->array_mem_used) {
+    vm->array_mem_used = arr->offset;
+  }
+  arr->bytes = 0;
+  size_t start = align_up(vm->array_mem_used, sizeof(zx80_int));
+  if (start + need > vm->array_mem_size) {
+    array_compact(vm);
+    start = vm->array_mem_used;
+    if (start + need > vm->array_mem_size) {
+      size_t grow = align_up(start + need - vm->array_mem_size, ARENA_ALIGN);
+      if (arena_shift(vm, REGION_FOR, (ptrdiff_t)grow) != 0) {
+        return -1;
+      }
+      vm->array_mem_size += grow;
+    }
+  }
+  arr->offset = start;
+  arr->bytes = need;
+  vm->array_mem_used = start + need;
+  return 0;
+}
+
+// DIM [BYTE|WORD] A(n[,m]), ...
+static int exec_dim(zx80_basic_t *vm, const char *s, exec_ctx_t *ctx) {
+  (void)ctx;
+  while (1) {
+    int shift = ARRAY_INT;
+    s = skip_ws(s);
+    if (is_tok(s, TOK_BYTE) || is_tok(s, TOK_WORD)) {
+      shift = is_tok(s, TOK_BYTE) ? ARRAY_BYTE : ARRAY_WORD;
+      s = skip_ws(s + 1);
+    }
+    int idx = 0;
+    s = parse_var(s, &idx);
+    if (!s) {
+      return -1;
+    }
+    zx80_int size1 = 0;
+    zx80_int size2 = 0;
+    int dims = 0;
+    s = parse_indices(vm, s, &size1, &size2, &dims);
+    if (!s) {
+      return -1;
+    }
+    if (size1 < 0 || size2 < 0) {
+      return -1;
+    }
+    if (dims == 1) {
+      size2 = 0;
+    }
+    uint64_t count = (uint64_t)(size1 + 1) * (uint64_t)(size2 + 1);
+    if (count > ((vm->array_mem_size + arena_free(vm)) >> shift)) {
+      return -1;
+    }
+    // Blocks stay zx80_int aligned whatever the cell type.
+    size_t need = align_up((size_t)count << shift, sizeof(zx80_int));
+    zx80_array_t *arr = find_array(vm, idx);
+    if (!arr) {
+      if (vm->array_count >= ZX80_BASIC_MAX_ARRAYS) {
+        return -1;
+      }
+      arr = &vm->arrays[vm->array_count++];
+      memset(arr, 0, sizeof(*arr));
+      arr->var = idx;
+      vm->array_of[idx] = (uint8_t)vm->array_count;
+    }
+    // A re-DIM may change the shape; on failure the array is gone, as its
+    // old contents would have been cleared anyway.
+    if (arr->bytes != need && array_alloc(vm, arr, need) != 0) {
+      arr->dims = 0;
+      return -1;
+    }
+    arr->dims = dims;
+    arr->size1 = size1;
+    arr->size2 = size2;
+    arr->stride = (size_t)size1 + 1;
+    arr->shift = (uint8_t)shift;
+    memset(vm->array_mem + arr->offset, 0, arr->bytes);
+    s = skip_ws(s);
+    if (*s != ',') {
+      break;
+    }
+    s++;
+  }
+  return 0;
+}
+
+// FILL A[, value]: every cell of A (0 if no value).
+static int exec_fill(zx80_basic_t *vm, const char *s, exec_ctx_t *ctx) {
+  (void)ctx;
+  zx80_array_t *arr = NULL;
+  s = parse_array_ref(vm, s, &arr);
+  if (!s) {
+    return -1;
+  }
+  zx80_int value = 0;
+  s = skip_ws(s);
+  if (*s == ',') {
+    s = parse_expr(vm, s + 1, &value);
+    if (!s) {
+      return -1;
+    }
+  }
+  size_t n = 0;
+  uint8_t *cells = array_cells(vm, arr, &n);
+  if (!cells) {
+    return -1;
+  }
+  array_fill(arr, cells, n, value);
+  return 0;
+}
+
+// COPY A TO B: cells in storage order, as many as the smaller array holds,
+// converted when the cell types differ.
+static int exec_copy(zx80_basic_t *vm, const char *s, exec_ctx_t *ctx) {
+  (void)ctx;
+  zx80_array_t *src = NULL;
+  zx80_array_t *dst = NULL;
+  s = parse_array_ref(vm, s, &src);
+  if (!s) {
+    return -1;
+  }
+  s = skip_ws(s);
+  if (!is_tok(s, TOK_TO)) {
+    return -1;
+  }
+  s = parse_array_ref(vm, s + 1, &dst);
+  if (!s) {
+    return -1;
+  }
+  size_t n = 0;
+  size_t m = 0;
+  uint8_t *from = array_cells(vm, src, &n);
+  uint8_t *to = array_cells(vm, dst, &m);
+  if (!from || !to) {
+    return -1;
+  }
+  n = (n < m) ? n : m;
+  if (src->shift == dst->shift) {
+    memmove(to, from, n << src->shift);
+    return 0;
+  }
+  for (size_t i = 0; i < n; ++i) {
+    cell_store(dst, to + (i << dst->shift),
+               cell_load(src, from + (i << src->shift)));
+  }
+  return 0;
+}
+
+// SORT A: ascending, over all cells in storage order.
+static int exec_sort(zx80_basic_t *vm, const char *s, exec_ctx_t *ctx) {
+  (void)ctx;
+  zx80_array_t *arr = NULL;
+  s = parse_array_ref(vm, s, &arr);
+  if (!s) {
+    return -1;
+  }
+  size_t n = 0;
+  uint8_t *cells = array_cells(vm, arr, &n);
+  if (!cells) {
+    return -1;
+  }
+  array_sort(arr, cells, n);
+  return 0;
+}
+
+static int exec_usr(zx80_basic_t *vm, const char *s, exec_ctx_t *ctx) {
+  (void)ctx;
+  zx80_int result = 0;
+  return parse_usr(vm, s, &result) ? 0 : -1;
+}
+
+static int exec_file(zx80_basic_t *vm, const char *s, exec_ctx_t *ctx) {
+  (void)vm;
+  (void)s;
+  (void)ctx;
+  return 0;
+}
+
+typedef int (*stmt_fn)(zx80_basic_t *vm, const char *s, exec_ctx_t *ctx);
+
+static const stmt_fn stmt_handlers[TOK_LAST - TOK_FIRST] = {
+    [TOK_REM - TOK_FIRST] = exec_rem,
+    [TOK_PRINT - TOK_FIRST] = exec_print,
+    [TOK_LET - TOK_FIRST] = exec_let,
+    [TOK_INPUT - TOK_FIRST] = exec_input,
+    [TOK_GOTO - TOK_FIRST] = exec_goto,
+    [TOK_IF - TOK_FIRST] = exec_if,
+    [TOK_END - TOK_FIRST] = exec_end,
+    [TOK_STOP - TOK_FIRST] = exec_stop,
+    [TOK_RUN - TOK_FIRST] = exec_run,
+    [TOK_LIST - TOK_FIRST] = exec_list,
+    [TOK_NEW - TOK_FIRST] = exec_new,
+    [TOK_CLS - TOK_FIRST] = exec_cls,
+    [TOK_CONT - TOK_FIRST] = exec_cont,
+    [TOK_GOSUB - TOK_FIRST] = exec_gosub,
+    [TOK_RETURN - TOK_FIRST] = exec_return,
+    [TOK_FOR - TOK_FIRST] = exec_for,
+    [TOK_NEXT - TOK_FIRST] = exec_next,
+    [TOK_POKE - TOK_FIRST] = exec_poke,
+    [TOK_RAND - TOK_FIRST] = exec_rand,
+    [TOK_DIM - TOK_FIRST] = exec_dim,
+    [TOK_LOAD - TOK_FIRST] = exec_file,
+    [TOK_SAVE - TOK_FIRST] = exec_file,
+    [TOK_FILL - TOK_FIRST] = exec_fill,
+    [TOK_COPY - TOK_FIRST] = exec_copy,
+    [TOK_SORT - TOK_FIRST] = exec_sort,
+    [TOK_USR - TOK_FIRST] = exec_usr,
+    [TOK_FAST - TOK_FIRST] = exec_fast,
+    [TOK_SLOW - TOK_FIRST] = exec_slow,
+};
+
+static int exec_statement(zx80_basic_t *vm, const char *s, exec_ctx_t *ctx) {
+  s = skip_ws(s);
+  if (is_stmt_end(s)) {
+    return 0;
+  }
+  uint8_t tok = (uint8_t)*s;
+  if (tok >= TOK_FIRST && tok < TOK_LAST) {
+    stmt_fn fn = stmt_handlers[tok - TOK_FIRST];
+    if (!fn) {
+      return -1;
+    }
+    return fn(vm, s + 1, ctx);
+  }
+  if (is_var_start(s)) {
+    const char *p = s;
+    int idx = 0;
+    p = parse_var(p, &idx);
+    if (p) {
+      const char *q = skip_ws(p);
+      if (q[0] == '=' || q[0] == '(' || q[0] == '$') {
+        return exec_let(vm, s, ctx);
+      }
+    }
+  }
+  return -1;
+}
+
+void zx80_basic_init(zx80_basic_t *vm, uint8_t *ram, size_t ram_size,
+                     uint8_t *str_mem, size_t str_mem_size, uint8_t *code,
+                     size_t code_size, zx80_io_t io) {
+  memset(vm, 0, sizeof(*vm));
+  vm->ram = ram;
+  vm->ram_size = ram_size;
+  if (str_mem) {
+    vm->str_mem = str_mem;
+    vm->str_mem_size = str_mem_size;
+  }
+#if ZX80_BASIC_USE_VM
+  if (code) {
+    vm->code = code;
+    vm->code_size = code_size;
+  }
+#else
+  (void)code;
+  (void)code_size;
+#endif
+  vm->io = io;
+  vm->rand_state = 1;
+  vars_clear(vm);
+  arena_clear(vm);
+}
+
+void zx80_basic_init_default(zx80_basic_t *vm, zx80_io_t io) {
+#if ZX80_BASIC_USE_VM
+  zx80_basic_init(vm, default_ram, sizeof(default_ram), default_str_mem,
+                  sizeof(default_str_mem), default_code, sizeof(default_code),
+                  io);
+#else
+  zx80_basic_init(vm, default_ram, sizeof(default_ram), default_str_mem,
+                  sizeof(default_str_mem), NULL, 0, io);
+#endif
+}
+
+int zx80_basic_register(zx80_basic_t *vm, const char *name, zx80_native_fn fn,
+                        void *user) {
+  if (!name || !fn || vm->native_count >= ZX80_BASIC_MAX_NATIVES) {
+    return -1;
+  }
+  zx80_native_t *n = &vm->natives[vm->native_count++];
+  n->name = name;
+  n->fn = fn;
+  n->user = user;
+  n->slot = -1;
+  return 0;
+}
+
+void zx80_basic_reset(zx80_basic_t *vm) {
+  set_fast(vm, 0);
+  page_close(vm);
+  vm->run_state = ZX80_STOPPED;
+  vm->prog_end = 0;
+  vars_clear(vm);
+  vm->str_var_count = 0;
+  vm->str_mem_used = 0;
+  vm->str_temp = 0;
+  vm->cont_ptr = NULL;
+  vm->rand_state = 1;
+  vm->array_count = 0;
+  memset(vm->array_of, 0, sizeof(vm->array_of));
+  arena_clear(vm);
+  vm->code_state = CODE_STALE;
+}
+
+void zx80_basic_list(zx80_basic_t *vm) {
+  program_close(vm);
+  list_program(vm);
+  out_flush(vm);
+}
+
+void zx80_basic_set_fast(zx80_basic_t *vm, int fast) {
+  set_fast(vm, fast);
+}
+
+void zx80_basic_string_stats(const zx80_basic_t *vm, zx80_str_stats_t *out) {
+  out->size = vm->str_mem_size;
+  out->used = vm->str_mem_used;
+  out->live = 0;
+  out->peak = vm->str_peak;
+  out->collections = vm->str_collections;
+  size_t pos = 0;
+  while (pos < vm->str_mem_used) {
+    const uint8_t *b = vm->str_mem + pos;
+    size_t n = 2 + (size_t)b[1];
+    if (b[0] != STR_DEAD) {
+      out->live += n;
+    }
+    pos += n;
+  }
+}
+
+// Line number of the stored line that contains the statement at s.
+static uint16_t line_at(zx80_basic_t *vm, const char *s) {
+  const uint8_t *p = vm->ram;
+  const uint8_t *end = vm->ram + vm->prog_end;
+  int page = page_of(vm, s);
+  if (page >= 0) {
+    p = page_buf(vm, page);
+    end = p + vm->pages[page].valid;
+  }
+  uint16_t line = 0;
+  while (p < end && p <= (const uint8_t *)s) {
+    line = read_u16(p);
+    p += 4 + read_u16(p + 2);
+  }
+  return line;
+}
+
+static const char *line_start(zx80_basic_t *vm, uint16_t line) {
+  if (vm->pager.read) {
+    return page_find(vm, line);
+  }
+  if (line == 0xFFFF) {
+    return (const char *)(vm->ram + 4);
+  }
+  uint8_t *target = find_line(vm, line);
+  return target ? (const char *)(target + 4) : NULL;
+}
+
+// Calls break_check, every statement in SLOW mode and every
+// ZX80_BASIC_FAST_POLL statements (or when poll_now is set) in FAST mode.
+// Returns 1 after a break, leaving CONT to go on at pc.
+static int break_poll(zx80_basic_t *vm, const uint8_t *pc) {
+  vm->poll_left = vm->fast ? ZX80_BASIC_FAST_POLL : 1;
+  vm->poll_now = 0;
+  if (vm->out_len) {
+    out_flush(vm);
+  }
+  if (!vm->io.break_check || !vm->io.break_check(vm->io.user)) {
+    return 0;
+  }
+  vm->cont_ptr = pc;
+  write_str(vm, "BREAK");
+  write_newline(vm);
+  return 1;
+}
+
+// Counts a step against the budget of a zx80_basic_step call (step_left is
+// the budget + 1, 0 when unlimited); when it is spent the program is
+// suspended at pc and the engine returns.
+static int step_spent(zx80_basic_t *vm, const void *pc) {
+  if (--vm->step_left) {
+    return 0;
+  }
+  vm->run_pc = (const uint8_t *)pc;
+  vm->run_state = ZX80_RUNNING;
+  return 1;
+}
+
+// Reference engine. pc is a statement position inside a stored line; at a
+// line's NUL terminator execution moves on to the next line.
+static int exec_program_from(zx80_basic_t *vm, const char *pc) {
+  vm->cont_ptr = NULL;
+  vm->page_error = 0;
+  vm->poll_left = 1;
+  while (vm->pager.read || (const uint8_t *)pc < vm->ram + vm->prog_end) {
+    vm->page_pc = pc;
+    if (*pc == '\0') {
+      vm->page_pc = NULL;
+      pc = next_line_text(vm, pc);
+      if (!pc) {
+        if (vm->page_error) {
+          handle_error(vm, "PAGE ERROR");
+          return -1;
+        }
+        break;
+      }
+      continue;
+    }
+    if ((!--vm->poll_left || vm->poll_now) &&
+        break_poll(vm, (const uint8_t *)pc)) {
+      return 0;
+    }
+    if (vm->step_left && step_spent(vm, pc)) {
+      return 0;
+    }
+
+    exec_ctx_t ctx;
+    ctx.next_stmt = stmt_next(pc);
+    ctx.resume = (const uint8_t *)ctx.next_stmt;
+    ctx.jump_ptr = NULL;
+    ctx.jump_line = 0xFFFF;
+    ctx.stop = 0;
+    ctx.skip_line = 0;
+    int res = exec_statement(vm, pc, &ctx);
+    if (res < 0) {
+      write_str(vm, "ERROR IN ");
+      write_int(vm, line_at(vm, pc));
+      write_newline(vm);
+      return -1;
+    }
+    if (ctx.stop) {
+      return 0;
+    }
+    if (res == 1 || (!ctx.jump_ptr && ctx.jump_line != 0xFFFF)) {
+      vm->page_pc = NULL;
+      pc = line_start(vm, ctx.jump_line);
+      if (!pc) {
+        handle_error(vm, vm->page_error ? "PAGE ERROR" : "LINE NOT FOUND");
+        return -1;
+      }
+      continue;
+    }
+    if (ctx.jump_ptr) {
+      pc = (const char *)ctx.jump_ptr;
+    } else if (ctx.skip_line) {
+      pc = line_end(pc);
+    } else {
+      pc = ctx.next_stmt;
+    }
+  }
+  return 0;
+}
+
+#if ZX80_BASIC_USE_VM
+// Bytecode engine. Each program line is compiled once per program version
+// into a compact stack-machine image in vm->code; the token walker above
+// stays as the reference implementation and still runs direct commands and
+// the statements the compiler leaves to it (OP_EXEC).
+//
+// Code image: [code ... OP_HALT] ... [line table]. The line table sits at
+// the top of the buffer, one {line, code offset} pair of u16 per line.
+// OP_GOTO, OP_GOSUB and OP_RUN carry line numbers only until vm_link
+// rewrites them into OP_JMP/OP_CALL with code offsets; those left to a
+// missing line fail when they run. OP_FOR's zero-trip
+// exit and the OP_JZ of an IF (which skips the rest of its line) are patched
+// to code offsets while the program is compiled.
+enum {
+  OP_HALT,
+  OP_LINE,
+  OP_PUSH8,
+  OP_PUSH16,
+  OP_PUSH32,
+  OP_LOAD,
+  OP_STORE,
+  OP_LOADA1,
+  OP_LOADA2,
+  OP_STOREA1,
+  OP_STOREA2,
+  OP_NEG,
+  OP_ADD,
+  OP_SUB,
+  OP_MUL,
+  OP_DIV,
+  OP_EQ,
+  OP_NE,
+  OP_LT,
+  OP_GT,
+  OP_LE,
+  OP_GE,
+  OP_RND,
+  OP_PEEK,
+  OP_PRINT_NUM,
+  OP_PRINT_STR,
+  OP_PRINT_SP,
+  OP_PRINT_NL,
+  OP_POKE,
+  OP_JZ,
+  OP_GOTO,
+  OP_GOSUB,
+  OP_RETURN,
+  OP_RUN,
+  OP_FOR,
+  OP_NEXT,
+  OP_END,
+  OP_STOP,
+  OP_CONT,
+  OP_EXEC,
+  OP_JMP,
+  OP_CALL,
+  OP_GOTO_DYN,
+  OP_GOSUB_DYN,
+  // Superinstructions for the hottest statement shapes, formed from the
+  // generic code by the compiler. OP_IF_xx v k16 addr jumps to addr unless
+  // var v relates to k; OP_ADDK/OP_SUBK v k16 is LET v=v+k / v=v-k;
+  // OP_NEXT_UP/OP_NEXT_DOWN v k8 is a NEXT paired with a FOR whose STEP is
+  // the constant +k/-k, falling back to OP_NEXT if the loop is another one.
+  // k is a whole number, so fixed-point builds fuse the same statements.
+  OP_IF_EQ,
+  OP_IF_NE,
+  OP_IF_LT,
+  OP_IF_GT,
+  OP_IF_LE,
+  OP_IF_GE,
+  OP_ADDK,
+  OP_SUBK,
+  OP_NEXT_UP,
+  OP_NEXT_DOWN,
+  // Bitwise AND/OR/NOT on -1/0 truth values. OP_AND_SKIP/OP_OR_SKIP addr
+  // jump to addr, keeping the left operand, when it is 0 / true.
+  OP_AND,
+  OP_OR,
+  OP_NOT,
+  OP_AND_SKIP,
+  OP_OR_SKIP,
+  // OP_SUM v pushes the sum of every cell of array v.
+  OP_SUM,
+  // OP_USR v n mask calls native v with n values popped (mask as for
+  // native_call); bit 7 of n drops the result (USR as a statement).
+  OP_USR,
+  // OP_EVAL off pushes the value of the expression at ram + off, worked out
+  // by parse_expr (string comparisons, LEN).
+  OP_EVAL,
+  OP_COUNT
+};
+
+// A zero-trip FOR whose exit is the code after the NEXT statement at `next`;
+// step is the FOR's STEP when it is a small constant, else 0. The pending
+// ones are kept in the code buffer, growing down from below the line table
+// towards the code, so only the buffer size limits them.
+typedef struct {
+  const char *next;
+  uint16_t patch;
+  int step;
+} for_fixup_t;
+
+typedef struct {
+  zx80_basic_t *vm;
+  const char *stmt;
+  uint16_t eol_chain;
+  uint8_t *fixups; // end of the fixup area, limit is its start
+  int fixup_count;
+  uint8_t *out;
+  uint8_t *limit;
+  int depth;
+  int fail;
+} compiler_t;
+
+static const uint8_t *line_table(zx80_basic_t *vm) {
+  return vm->code + vm->code_size - vm->code_lines * 4;
+}
+
+static void emit_u8(compiler_t *c, uint8_t v) {
+  if (c->out >= c->limit) {
+    c->fail = 1;
+    return;
+  }
+  *c->out++ = v;
+}
+
+static for_fixup_t fixup_get(const compiler_t *c, int i) {
+  for_fixup_t f;
+  memcpy(&f, c->fixups - (size_t)(i + 1) * sizeof(f), sizeof(f));
+  return f;
+}
+
+static void fixup_put(compiler_t *c, int i, const for_fixup_t *f) {
+  memcpy(c->fixups - (size_t)(i + 1) * sizeof(*f), f, sizeof(*f));
+}
+
+static void fixups_keep(compiler_t *c, int count) {
+  c->fixup_count = count;
+  c->limit = c->fixups - (size_t)count * sizeof(for_fixup_t);
+}
+
+static void emit_u16(compiler_t *c, uint16_t v) {
+  emit_u8(c, (uint8_t)(v & 0xFF));
+  emit_u8(c, (uint8_t)(v >> 8));
+}
+
+static void emit_push(compiler_t *c, int delta) {
+  c->depth += delta;
+  if (c->depth > ZX80_BASIC_EVAL_DEPTH) {
+    c->fail = 1;
+  }
+}
+
+static void emit_const(compiler_t *c, zx80_int v) {
+  uint32_t u = (uint32_t)v;
+  if (u <= 0xFF) {
+    emit_u8(c, OP_PUSH8);
+    emit_u8(c, (uint8_t)u);
+  } else if (u <= 0xFFFF) {
+    emit_u8(c, OP_PUSH16);
+    emit_u16(c, (uint16_t)u);
+  } else {
+    emit_u8(c, OP_PUSH32);
+    emit_u16(c, (uint16_t)(u & 0xFFFF));
+    emit_u16(c, (uint16_t)(u >> 16));
+  }
+  emit_push(c, 1);
+}
+
+// Matches the push emit_const() gives a whole number 0..65535 (in Q16.16
+// with ZX80_BASIC_FIXED, where only 0 fits OP_PUSH8/16 and the others take
+// OP_PUSH32). Returns the code after it and sets *k, or returns NULL.
+static const uint8_t *match_whole(const uint8_t *p, const uint8_t *end,
+                                  zx80_int *k) {
+  uint32_t u = 0;
+  if (end - p >= 2 && p[0] == OP_PUSH8) {
+    u = p[1];
+    p += 2;
+  } else if (end - p >= 3 && p[0] == OP_PUSH16) {
+    u = read_u16(p + 1);
+    p += 3;
+  } else if (end - p >= 5 && p[0] == OP_PUSH32) {
+    u = read_u32(p + 1);
+    p += 5;
+  } else {
+    return NULL;
+  }
+#if ZX80_BASIC_FIXED
+  if ((u & 0xFFFFu) != 0 || u > 0x7FFF0000u) {
+    return NULL;
+  }
+  u >>= 16;
+#else
+  if (u > 0xFFFFu) {
+    return NULL;
+  }
+#endif
+  *k = (zx80_int)u;
+  return p;
+}
+
+// Matches the code of `v <op> k` as compiled from a scalar variable and a
+// whole literal 0..65535: OP_LOAD v, the push of k, op. Returns op or -1.
+static int match_var_const(const uint8_t *p, const uint8_t *end, int *var,
+                           zx80_int *k) {
+  if (end - p < 2 || p[0] != OP_LOAD) {
+    return -1;
+  }
+  *var = p[1];
+  p = match_whole(p + 2, end, k);
+  return (p && end - p == 1) ? *p : -1;
+}
+
+// Returns the value of a constant STEP expression that fits OP_NEXT_UP or
+// OP_NEXT_DOWN (1..255 either way), else 0.
+static int match_step(const uint8_t *p, const uint8_t *end) {
+  zx80_int k = 0;
+  p = match_whole(p, end, &k);
+  if (!p || k == 0 || k > 0xFF) {
+    return 0;
+  }
+  if (p == end) {
+    return (int)k;
+  }
+  return (end - p == 1 && p[0] == OP_NEG) ? -(int)k : 0;
+}
+
+static const char *compile_expr(compiler_t *c, const char *s);
+
+static const char *compile_call(compiler_t *c, const char *s, uint8_t op) {
+  s = skip_ws(s);
+  if (*s != '(') {
+    return NULL;
+  }
+  s = compile_expr(c, s + 1);
+  if (!s) {
+    return NULL;
+  }
+  s = skip_ws(s);
+  if (*s != ')') {
+    return NULL;
+  }
+  emit_u8(c, op);
+  return s + 1;
 }
 
-static const char *parse_term(zx80_basic_t *vm, const char *s, zx80_int *out) {
-  s = parse_factor(vm, s, out);
-  if (!s) {
+// USR NAME[(args)] after the USR token; A() arguments push the slot of A.
+static const char *compile_usr(compiler_t *c, const char *s, int statement) {
+  int slot = 0;
+  s = parse_var(skip_ws(s), &slot);
+  if (!s || *s == '$') {
     return NULL;
   }
-  while (1) {
-    s = skip_ws(s);
-    if (*s != '*' && *s != '/') {
-      break;
-    }
-    char op = *s++;
-    zx80_int rhs = 0;
-    s = parse_factor(vm, s, &rhs);
-    if (!s) {
-      return NULL;
-    }
-    if (op == '*') {
-      *out = (*out) * rhs;
-    } else {
-      if (rhs == 0) {
-        *out = 0;
+  int argc = 0;
+  unsigned arrays = 0;
+  s = skip_ws(s);
+  if (*s == '(') {
+    s = skip_ws(s + 1);
+    while (*s != ')') {
+      if (argc >= ZX80_BASIC_NATIVE_ARGS) {
+        return NULL;
+      }
+      int idx = 0;
+      const char *q = is_var_start(s) ? parse_var(s, &idx) : NULL;
+      if (q && *q == '(' && *skip_ws(q + 1) == ')') {
+        emit_const(c, idx);
+        arrays |= 1u << argc;
+        s = skip_ws(q + 1) + 1;
       } else {
-        *out = (*out) / rhs;
+        s = compile_expr(c, s);
+        if (!s) {
+          return NULL;
+        }
+      }
+      argc++;
+      s = skip_ws(s);
+      if (*s == ',') {
+        s = skip_ws(s + 1);
+      } else if (*s != ')') {
+        return NULL;
       }
     }
+    s++;
   }
+  emit_u8(c, OP_USR);
+  emit_u8(c, (uint8_t)slot);
+  emit_u8(c, (uint8_t)(argc | (statement ? 0x80 : 0)));
+  emit_u8(c, (uint8_t)arrays);
+  emit_push(c, (statement ? 0 : 1) - argc);
   return s;
 }
 
-static const char *parse_arith(zx80_basic_t *vm, const char *s,
-                               zx80_int *out) {
-  s = parse_term(vm, s, out);
+static const char *compile_indices(compiler_t *c, const char *s, int *dims) {
+  s = skip_ws(s);
+  if (*s != '(') {
+    return NULL;
+  }
+  s = compile_expr(c, s + 1);
   if (!s) {
     return NULL;
   }
-  while (1) {
-    s = skip_ws(s);
-    if (*s != '+' && *s != '-') {
-      break;
-    }
-    char op = *s++;
-    zx80_int rhs = 0;
-    s = parse_term(vm, s, &rhs);
+  s = skip_ws(s);
+  *dims = 1;
+  if (*s == ',') {
+    s = compile_expr(c, s + 1);
     if (!s) {
       return NULL;
     }
-    if (op == '+') {
-      *out = (*out) + rhs;
-    } else {
-      *out = (*out) - rhs;
-    }
+    *dims = 2;
   }
-  return s;
-}
-
-static const char *parse_expr(zx80_basic_t *vm, const char *s, zx80_int *out) {
-  s = parse_arith(vm, s, out);
-  if (!s) {
+  s = skip_ws(s);
+  if (*s != ')') {
     return NULL;
   }
+  return s + 1;
+}
+
+static const char *compile_factor(compiler_t *c, const char *s) {
   s = skip_ws(s);
-  if (*s != '<' && *s != '>' && *s != '=') {
+  if (*s == '(') {
+    s = compile_expr(c, s + 1);
+    if (!s) {
+      return NULL;
+    }
+    s = skip_ws(s);
+    if (*s != ')') {
+      return NULL;
+    }
+    return s + 1;
+  }
+  if (*s == '+' || *s == '-') {
+    char sign = *s++;
+    s = compile_factor(c, s);
+    if (s && sign == '-') {
+      emit_u8(c, OP_NEG);
+    }
     return s;
   }
-  char op1 = *s++;
-  char op2 = '\0';
-  if ((op1 == '<' || op1 == '>') && (*s == '=' || *s == '>')) {
-    op2 = *s++;
+  if (is_tok(s, TOK_RND)) {
+    return compile_call(c, s + 1, OP_RND);
   }
-  zx80_int rhs = 0;
-  s = parse_arith(vm, s, &rhs);
-  if (!s) {
-    return NULL;
+  if (is_tok(s, TOK_PEEK)) {
+    return compile_call(c, s + 1, OP_PEEK);
   }
-  int result = 0;
-  if (op1 == '=') {
-    result = (*out == rhs);
-  } else if (op1 == '<' && op2 == '>') {
-    result = (*out != rhs);
-  } else if (op1 == '<' && op2 == '=') {
-    result = (*out <= rhs);
-  } else if (op1 == '>' && op2 == '=') {
-    result = (*out >= rhs);
-  } else if (op1 == '<') {
-    result = (*out < rhs);
-  } else if (op1 == '>') {
-    result = (*out > rhs);
+  if (is_tok(s, TOK_USR)) {
+    return compile_usr(c, s + 1, 0);
   }
-  *out = result ? -1 : 0;
-  return s;
-}
-
-static uint8_t *find_line(zx80_basic_t *vm, uint16_t line,
-                          uint8_t **out_prev) {
-  uint8_t *p = vm->ram;
-  uint8_t *prev = NULL;
-  while (p < vm->ram + vm->prog_end) {
-    uint16_t ln = read_u16(p);
-    uint16_t len = read_u16(p + 2);
-    if (ln == line) {
-      if (out_prev) {
-        *out_prev = prev;
-      }
-      return p;
+  if (is_tok(s, TOK_SUM)) {
+    s = skip_ws(s + 1);
+    if (*s != '(') {
+      return NULL;
     }
-    if (ln > line) {
-      break;
+    int idx = 0;
+    s = parse_var(skip_ws(s + 1), &idx);
+    if (!s || *s == '$') {
+      return NULL;
     }
-    prev = p;
-    p += 4 + len;
-  }
-  if (out_prev) {
-    *out_prev = prev;
+    s = skip_ws(s);
+    if (*s != ')') {
+      return NULL;
+    }
+    emit_u8(c, OP_SUM);
+    emit_u8(c, (uint8_t)idx);
+    emit_push(c, 1);
+    return s + 1;
   }
-  return NULL;
-}
-
-static uint8_t *find_insert_pos(zx80_basic_t *vm, uint16_t line) {
-  uint8_t *p = vm->ram;
-  while (p < vm->ram + vm->prog_end) {
-    uint16_t ln = read_u16(p);
-    uint16_t len = read_u16(p + 2);
-    if (ln > line) {
-      return p;
+  if (is_var_start(s)) {
+    int idx = 0;
+    s = parse_var(s, &idx);
+    if (!s || *s == '$') {
+      return NULL;
     }
-    p += 4 + len;
+    const char *ns = skip_ws(s);
+    if (*ns == '(') {
+      int dims = 0;
+      ns = compile_indices(c, ns, &dims);
+      if (!ns) {
+        return NULL;
+      }
+      if (dims == 2) {
+        emit_push(c, -1);
+      }
+      emit_u8(c, dims == 2 ? OP_LOADA2 : OP_LOADA1);
+      emit_u8(c, (uint8_t)idx);
+      return ns;
+    }
+    emit_u8(c, OP_LOAD);
+    emit_u8(c, (uint8_t)idx);
+    emit_push(c, 1);
+    return s;
   }
-  return p;
-}
-
-static int delete_line(zx80_basic_t *vm, uint16_t line) {
-  uint8_t *line_ptr = find_line(vm, line, NULL);
-  if (!line_ptr) {
-    return 0;
+  zx80_int v = 0;
+  s = parse_literal(s, &v);
+  if (s) {
+    emit_const(c, v);
   }
-  uint16_t len = read_u16(line_ptr + 2);
-  uint8_t *next = line_ptr + 4 + len;
-  size_t tail = (size_t)(vm->ram + vm->prog_end - next);
-  memmove(line_ptr, next, tail);
-  vm->prog_end -= (4 + len);
-  return 1;
+  return s;
 }
 
-static int insert_line(zx80_basic_t *vm, uint16_t line, const char *text,
-                       size_t text_len) {
-  delete_line(vm, line);
-  size_t need = 4 + text_len;
-  if (vm->prog_end + need > vm->ram_size) {
-    return -1;
+// Same grammar as parse_climb(). AND/OR compile their right operand behind
+// OP_AND_SKIP/OP_OR_SKIP, which jump over it when the left decides.
+static const char *compile_climb(compiler_t *c, const char *s, int min_prec) {
+  s = skip_ws(s);
+  if (is_tok(s, TOK_NOT) && min_prec <= PREC_NOT) {
+    s = compile_climb(c, s + 1, PREC_NOT);
+    emit_u8(c, OP_NOT);
+  } else {
+    s = compile_factor(c, s);
   }
-  uint8_t *pos = find_insert_pos(vm, line);
-  size_t tail = (size_t)(vm->ram + vm->prog_end - pos);
-  memmove(pos + need, pos, tail);
-  write_u16(pos, line);
-  write_u16(pos + 2, (uint16_t)text_len);
-  memcpy(pos + 4, text, text_len);
-  vm->prog_end += need;
-  return 0;
-}
-
-static void list_program(zx80_basic_t *vm) {
-  uint8_t *p = vm->ram;
-  while (p < vm->ram + vm->prog_end) {
-    uint16_t ln = read_u16(p);
-    uint16_t len = read_u16(p + 2);
-    write_int(vm, ln);
-    write_char(vm, ' ');
-    for (uint16_t i = 0; i < len; ++i) {
-      write_char(vm, (char)p[4 + i]);
+  while (s) {
+    int op = 0;
+    const char *ns = NULL;
+    int prec = binary_op(skip_ws(s), &op, &ns);
+    if (prec == 0 || prec < min_prec) {
+      break;
+    }
+    uint16_t patch = 0;
+    int logic = (op == TOK_AND || op == TOK_OR);
+    if (logic) {
+      emit_u8(c, op == TOK_AND ? OP_AND_SKIP : OP_OR_SKIP);
+      patch = (uint16_t)(c->out - c->vm->code);
+      emit_u16(c, 0);
+    }
+    s = compile_climb(c, ns, prec + 1);
+    uint8_t code = OP_EQ;
+    switch (op) {
+    case '*':
+      code = OP_MUL;
+      break;
+    case '/':
+      code = OP_DIV;
+      break;
+    case '+':
+      code = OP_ADD;
+      break;
+    case '-':
+      code = OP_SUB;
+      break;
+    case TOK_AND:
+      code = OP_AND;
+      break;
+    case TOK_OR:
+      code = OP_OR;
+      break;
+    default:
+      code = (uint8_t)(OP_EQ + (op - REL_EQ));
+      break;
+    }
+    emit_u8(c, code);
+    emit_push(c, -1);
+    if (logic && !c->fail) {
+      write_u16(c->vm->code + patch, (uint16_t)(c->out - c->vm->code));
     }
-    write_newline(vm);
-    p += 4 + len;
   }
+  return s;
 }
 
-static void handle_error(zx80_basic_t *vm, const char *msg) {
-  write_str(vm, msg);
-  write_newline(vm);
+// An expression the stack code cannot express (strings are only handled by
+// the walker's parser) is left to OP_EVAL, so its statement still compiles.
+// It is parsed here with eval_skip set just to find where it ends.
+static const char *compile_expr(compiler_t *c, const char *s) {
+  uint8_t *start = c->out;
+  int depth = c->depth;
+  const char *end = compile_climb(c, s, PREC_OR);
+  if (end || c->fail) {
+    return end;
+  }
+  c->out = start;
+  c->depth = depth;
+  zx80_int v = 0;
+  size_t mark = c->vm->str_temp;
+  c->vm->eval_skip++;
+  end = parse_expr(c->vm, s, &v);
+  c->vm->eval_skip--;
+  c->vm->str_temp = mark;
+  size_t off = (size_t)((const uint8_t *)s - c->vm->ram);
+  if (!end || off > 0xFFFF) {
+    return NULL;
+  }
+  emit_u8(c, OP_EVAL);
+  emit_u16(c, (uint16_t)off);
+  emit_push(c, 1);
+  return end;
 }
 
-static int exec_statement(zx80_basic_t *vm, const char *s,
-                          const uint8_t *current_line,
-                          const uint8_t *next_line,
-                          const uint8_t **jump_ptr, uint16_t *jump_line,
-                          int *stop);
-
-static int exec_print(zx80_basic_t *vm, const char *s) {
+static const char *compile_print(compiler_t *c, const char *s) {
   s = skip_ws(s);
-  if (*s == '\0') {
-    write_newline(vm);
-    return 0;
+  if (is_stmt_end(s)) {
+    emit_u8(c, OP_PRINT_NL);
+    return s;
   }
   int suppress_nl = 0;
-  while (*s) {
+  while (!is_stmt_end(s)) {
     s = skip_ws(s);
+    suppress_nl = 0;
     if (*s == '"') {
-      s++;
+      const char *start = ++s;
       while (*s && *s != '"') {
-        write_char(vm, *s++);
+        s++;
+      }
+      size_t len = (size_t)(s - start);
+      while (len > 0) {
+        uint8_t chunk = (uint8_t)(len > 255 ? 255 : len);
+        emit_u8(c, OP_PRINT_STR);
+        emit_u8(c, chunk);
+        for (uint8_t i = 0; i < chunk; ++i) {
+          emit_u8(c, (uint8_t)*start++);
+        }
+        len -= chunk;
       }
       if (*s == '"') {
         s++;
       }
+      // String expressions ("A"+B$, "A"<B$) are left to the walker.
+      const char *ns = skip_ws(s);
+      if (*ns == '+' || *ns == '<' || *ns == '>' || *ns == '=' ||
+          *ns == '(') {
+        return NULL;
+      }
     } else {
-      zx80_int v = 0;
-      const char *ns = parse_expr(vm, s, &v);
-      if (!ns) {
-        return -1;
+      s = compile_expr(c, s);
+      if (!s) {
+        return NULL;
       }
-      write_int(vm, v);
-      s = ns;
+      emit_u8(c, OP_PRINT_NUM);
+      emit_push(c, -1);
     }
     s = skip_ws(s);
     if (*s == ';') {
@@ -512,648 +3708,1901 @@ static int exec_print(zx80_basic_t *vm, const char *s) {
       continue;
     }
     if (*s == ',') {
-      suppress_nl = 0;
-      write_char(vm, ' ');
+      emit_u8(c, OP_PRINT_SP);
       s++;
       continue;
     }
     break;
   }
   if (!suppress_nl) {
-    write_newline(vm);
+    emit_u8(c, OP_PRINT_NL);
   }
-  return 0;
+  return s;
 }
 
-static int exec_let(zx80_basic_t *vm, const char *s) {
+static const char *compile_let(compiler_t *c, const char *s) {
   int idx = 0;
   s = parse_var(s, &idx);
   if (!s) {
-    return -1;
+    return NULL;
   }
   s = skip_ws(s);
-  zx80_int i = 0;
-  zx80_int j = 0;
   int dims = 0;
-  int is_array = 0;
   if (*s == '(') {
-    s = parse_indices(vm, s, &i, &j, &dims);
+    s = compile_indices(c, s, &dims);
     if (!s) {
-      return -1;
+      return NULL;
     }
-    is_array = 1;
     s = skip_ws(s);
   }
-  if (*s != '=') {
-    return -1;
+  if (*s != '=') {
+    return NULL;
+  }
+  uint8_t *start = c->out;
+  int depth = c->depth;
+  s = compile_expr(c, s + 1);
+  if (!s) {
+    return NULL;
+  }
+  int var = 0;
+  zx80_int k = 0;
+  int op = (dims == 0) ? match_var_const(start, c->out, &var, &k) : -1;
+  if ((op == OP_ADD || op == OP_SUB) && var == idx) {
+    c->out = start;
+    c->depth = depth;
+    emit_u8(c, op == OP_ADD ? OP_ADDK : OP_SUBK);
+    emit_u8(c, (uint8_t)idx);
+    emit_u16(c, (uint16_t)k);
+    return s;
+  }
+  if (dims == 0) {
+    emit_u8(c, OP_STORE);
+  } else {
+    emit_u8(c, dims == 2 ? OP_STOREA2 : OP_STOREA1);
+  }
+  emit_u8(c, (uint8_t)idx);
+  emit_push(c, -(dims + 1));
+  return s;
+}
+
+static const char *compile_jump(compiler_t *c, const char *s, uint8_t op) {
+  uint16_t line = 0;
+  s = parse_line_num(s, &line);
+  if (s) {
+    emit_u8(c, op);
+    emit_u16(c, line);
+  }
+  return s;
+}
+
+// A literal target is linked to a code offset; anything else is evaluated
+// at run time and looked up in the line table.
+static const char *compile_target(compiler_t *c, const char *s, uint8_t op,
+                                  uint8_t dyn_op) {
+  uint16_t line = 0;
+  const char *e = parse_line_num(s, &line);
+  if (e && is_stmt_end(skip_ws(e))) {
+    return compile_jump(c, s, op);
+  }
+  s = compile_expr(c, s);
+  if (s) {
+    emit_u8(c, dyn_op);
+    emit_push(c, -1);
+  }
+  return s;
+}
+
+static const char *compile_statement(compiler_t *c, const char *s);
+
+static const char *compile_if(compiler_t *c, const char *s) {
+  uint8_t *start = c->out;
+  int depth = c->depth;
+  s = compile_expr(c, s);
+  if (!s) {
+    return NULL;
+  }
+  s = skip_ws(s);
+  if (!is_tok(s, TOK_THEN)) {
+    return NULL;
+  }
+  s = skip_ws(s + 1);
+  int var = 0;
+  zx80_int k = 0;
+  int op = match_var_const(start, c->out, &var, &k);
+  if (op >= OP_EQ && op <= OP_GE) {
+    c->out = start;
+    c->depth = depth;
+    emit_u8(c, (uint8_t)(OP_IF_EQ + (op - OP_EQ)));
+    emit_u8(c, (uint8_t)var);
+    emit_u16(c, (uint16_t)k);
+  } else {
+    emit_u8(c, OP_JZ);
+    emit_push(c, -1);
+  }
+  // A false condition skips the rest of the line: chain the operand into
+  // the list patched when the line ends.
+  uint16_t patch = (uint16_t)(c->out - c->vm->code);
+  emit_u16(c, c->eol_chain);
+  c->eol_chain = patch;
+  zx80_int line = 0;
+  if (parse_num(s, &line)) {
+    return compile_jump(c, s, OP_GOTO);
+  }
+  return compile_statement(c, s);
+}
+
+// Pairs a FOR with the NEXT that closes it, using the same forward scan the
+// reference engine does for a zero-trip loop, and emits the exit operand.
+// The operand is patched once the NEXT statement has been compiled.
+static void emit_for_exit(compiler_t *c, int idx, int step) {
+  uint16_t patch = (uint16_t)(c->out - c->vm->code);
+  emit_u16(c, 0xFFFF);
+  const char *next = find_for_exit(c->vm, stmt_next(c->stmt), idx);
+  if (!next) {
+    return;
+  }
+  if (c->limit - c->out < (ptrdiff_t)sizeof(for_fixup_t)) {
+    c->fail = 1; // the code buffer is full
+    return;
+  }
+  for_fixup_t f;
+  f.next = next;
+  f.patch = patch;
+  f.step = step;
+  fixup_put(c, c->fixup_count, &f);
+  fixups_keep(c, c->fixup_count + 1);
+}
+
+static const char *compile_for(compiler_t *c, const char *s) {
+  int idx = 0;
+  s = parse_var(s, &idx);
+  if (!s) {
+    return NULL;
+  }
+  s = skip_ws(s);
+  if (*s != '=') {
+    return NULL;
+  }
+  s = compile_expr(c, s + 1);
+  if (!s) {
+    return NULL;
+  }
+  s = skip_ws(s);
+  if (!is_tok(s, TOK_TO)) {
+    return NULL;
+  }
+  s = compile_expr(c, s + 1);
+  if (!s) {
+    return NULL;
+  }
+  s = skip_ws(s);
+  uint8_t *step = c->out;
+  if (is_tok(s, TOK_STEP)) {
+    s = compile_expr(c, s + 1);
+    if (!s) {
+      return NULL;
+    }
+  } else {
+    emit_const(c, NUM_FROM_INT(1));
+  }
+  int k = match_step(step, c->out);
+  emit_u8(c, OP_FOR);
+  emit_u8(c, (uint8_t)idx);
+  emit_for_exit(c, idx, k);
+  emit_push(c, -3);
+  return s;
+}
+
+static const char *compile_next(compiler_t *c, const char *s) {
+  s = skip_ws(s);
+  int idx = 0xFF;
+  if (!is_stmt_end(s)) {
+    s = parse_var(s, &idx);
+    if (!s) {
+      return NULL;
+    }
+  }
+  int step = 0;
+  for (int i = 0; i < c->fixup_count; i++) {
+    for_fixup_t f = fixup_get(c, i);
+    if (f.next == c->stmt) {
+      step = f.step;
+      break;
+    }
+  }
+  if (step != 0) {
+    emit_u8(c, step > 0 ? OP_NEXT_UP : OP_NEXT_DOWN);
+    emit_u8(c, (uint8_t)idx);
+    emit_u8(c, (uint8_t)(step > 0 ? step : -step));
+    return s;
   }
-  s++;
-  zx80_int v = 0;
-  s = parse_expr(vm, s, &v);
+  emit_u8(c, OP_NEXT);
+  emit_u8(c, (uint8_t)idx);
+  return s;
+}
+
+static const char *compile_poke(compiler_t *c, const char *s) {
+  s = compile_expr(c, s);
   if (!s) {
-    return -1;
+    return NULL;
   }
-  if (!is_array) {
-    vm->vars[idx] = v;
-    return 0;
+  s = skip_ws(s);
+  if (*s != ',') {
+    return NULL;
   }
-  zx80_array_t *arr = find_array(vm, idx);
-  if (!arr || arr->dims != dims) {
-    return -1;
+  s = compile_expr(c, s + 1);
+  if (s) {
+    emit_u8(c, OP_POKE);
+    emit_push(c, -2);
   }
-  zx80_int *cell = array_at(vm, arr, i, j);
-  if (!cell) {
-    return -1;
+  return s;
+}
+
+static const char *compile_run(compiler_t *c, const char *s) {
+  s = skip_ws(s);
+  if (!is_stmt_end(s)) {
+    return compile_jump(c, s, OP_RUN);
   }
-  *cell = v;
-  return 0;
+  emit_u8(c, OP_RUN);
+  emit_u16(c, 0xFFFF);
+  return s;
 }
 
-static int exec_input(zx80_basic_t *vm, const char *s) {
-  int idx = 0;
-  s = parse_var(s, &idx);
-  if (!s) {
-    return -1;
+static const char *compile_op(compiler_t *c, const char *s, uint8_t op) {
+  emit_u8(c, op);
+  return s;
+}
+
+// Compiles one statement. Returns NULL when the statement is left to the
+// reference handler, in which case the caller emits OP_EXEC for it.
+static const char *compile_statement(compiler_t *c, const char *s) {
+  s = skip_ws(s);
+  uint8_t *start = c->out;
+  uint16_t eol_chain = c->eol_chain;
+  int fixup_count = c->fixup_count;
+  const char *text = s;
+  const char *end = NULL;
+  switch ((uint8_t)*s) {
+  case '\0':
+  case ':':
+  case TOK_REM:
+    return s;
+  case TOK_PRINT:
+    end = compile_print(c, s + 1);
+    break;
+  case TOK_LET:
+    end = compile_let(c, s + 1);
+    break;
+  case TOK_GOTO:
+    end = compile_target(c, s + 1, OP_GOTO, OP_GOTO_DYN);
+    break;
+  case TOK_IF:
+    end = compile_if(c, s + 1);
+    break;
+  case TOK_END:
+    end = compile_op(c, s + 1, OP_END);
+    break;
+  case TOK_STOP:
+    end = compile_op(c, s + 1, OP_STOP);
+    break;
+  case TOK_RUN:
+    end = compile_run(c, s + 1);
+    break;
+  case TOK_CONT:
+    end = compile_op(c, s + 1, OP_CONT);
+    break;
+  case TOK_GOSUB:
+    end = compile_target(c, s + 1, OP_GOSUB, OP_GOSUB_DYN);
+    break;
+  case TOK_RETURN:
+    end = compile_op(c, s + 1, OP_RETURN);
+    break;
+  case TOK_FOR:
+    end = compile_for(c, s + 1);
+    break;
+  case TOK_NEXT:
+    end = compile_next(c, s + 1);
+    break;
+  case TOK_POKE:
+    end = compile_poke(c, s + 1);
+    break;
+  case TOK_USR:
+    end = compile_usr(c, s + 1, 1);
+    break;
+  default:
+    if (is_var_start(s)) {
+      int idx = 0;
+      const char *q = parse_var(s, &idx);
+      if (q) {
+        q = skip_ws(q);
+        if (q[0] == '=' || q[0] == '(') {
+          end = compile_let(c, s);
+        }
+      }
+    }
+    break;
   }
-  write_str(vm, "? ");
-  if (!vm->io.read_line) {
-    return -1;
+  if (end || c->fail) {
+    return end;
   }
-  char buf[64];
-  int len = vm->io.read_line(buf, sizeof(buf), vm->io.user);
-  if (len <= 0) {
-    return -1;
+  size_t off = (size_t)((const uint8_t *)text - c->vm->ram);
+  c->out = start;
+  c->eol_chain = eol_chain;
+  fixups_keep(c, fixup_count);
+  c->depth = 0;
+  if (off > 0xFFFF) {
+    c->fail = 1;
+    return NULL;
   }
-  buf[sizeof(buf) - 1] = '\0';
-  zx80_int v = 0;
-  if (!parse_int(buf, &v)) {
-    v = 0;
+  emit_u8(c, OP_EXEC);
+  emit_u16(c, (uint16_t)off);
+  return text;
+}
+
+// The line table doubles as the sorted line-number index: it is rebuilt by
+// the compile that follows any insert_line/delete_line, and computed jumps
+// binary search it.
+static const uint8_t *vm_find_line(zx80_basic_t *vm, uint16_t line) {
+  const uint8_t *t = line_table(vm);
+  size_t lo = 0;
+  size_t hi = vm->code_lines;
+  while (lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    uint16_t ln = read_u16(t + mid * 4);
+    if (ln == line) {
+      return vm->code + read_u16(t + mid * 4 + 2);
+    }
+    if (ln < line) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
   }
-  vm->vars[idx] = v;
-  return 0;
+  return NULL;
 }
 
-static int exec_if(zx80_basic_t *vm, const char *s,
-                   const uint8_t *current_line, const uint8_t *next_line,
-                   const uint8_t **jump_ptr, uint16_t *jump_line, int *stop) {
-  zx80_int cond = 0;
-  s = parse_expr(vm, s, &cond);
-  if (!s) {
-    return -1;
+// Index of the line holding pc, found by binary search on the code offsets.
+static size_t vm_line_index(zx80_basic_t *vm, const uint8_t *pc) {
+  const uint8_t *t = line_table(vm);
+  size_t off = (size_t)(pc - vm->code);
+  size_t lo = 0;
+  size_t hi = vm->code_lines;
+  while (hi - lo > 1) {
+    size_t mid = (lo + hi) / 2;
+    if (read_u16(t + mid * 4 + 2) <= off) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
   }
-  s = skip_ws(s);
-  const char *kw = match_kw(s, "THEN");
-  if (!kw) {
-    return -1;
+  return lo;
+}
+
+static const uint8_t *vm_line_start(zx80_basic_t *vm, size_t index) {
+  if (index >= vm->code_lines) {
+    return vm->code + vm->code_end - 1;
   }
-  s = kw;
-  s = skip_ws(s);
-  if (cond == 0) {
-    return 0;
+  return vm->code + read_u16(line_table(vm) + index * 4 + 2);
+}
+
+static size_t op_length(const uint8_t *pc) {
+  switch (*pc) {
+  case OP_PUSH8:
+  case OP_LOAD:
+  case OP_STORE:
+  case OP_LOADA1:
+  case OP_LOADA2:
+  case OP_STOREA1:
+  case OP_STOREA2:
+  case OP_NEXT:
+  case OP_SUM:
+    return 2;
+  case OP_PUSH16:
+  case OP_JZ:
+  case OP_AND_SKIP:
+  case OP_OR_SKIP:
+  case OP_GOTO:
+  case OP_GOSUB:
+  case OP_RUN:
+  case OP_EXEC:
+  case OP_EVAL:
+  case OP_JMP:
+  case OP_CALL:
+    return 3;
+  case OP_FOR:
+  case OP_ADDK:
+  case OP_SUBK:
+  case OP_USR:
+    return 4;
+  case OP_NEXT_UP:
+  case OP_NEXT_DOWN:
+    return 3;
+  case OP_IF_EQ:
+  case OP_IF_NE:
+  case OP_IF_LT:
+  case OP_IF_GT:
+  case OP_IF_LE:
+  case OP_IF_GE:
+    return 6;
+  case OP_PUSH32:
+    return 5;
+  case OP_PRINT_STR:
+    return 2 + (size_t)pc[1];
+  default:
+    return 1;
   }
-  if (isdigit((unsigned char)*s)) {
-    zx80_int line = 0;
-    const char *ns = parse_int(s, &line);
-    if (!ns) {
-      return -1;
-    }
-    if (line < 0 || line > 65535) {
-      return -1;
+}
+
+// Resolves every constant jump target once, so taken jumps cost nothing at
+// run time. A jump to a missing line is left as it is and reports LINE NOT
+// FOUND only if it is taken, like on the reference engine.
+static void vm_link(zx80_basic_t *vm) {
+  uint8_t *pc = vm->code;
+  uint8_t *end = vm->code + vm->code_end;
+  while (pc < end) {
+    uint8_t op = *pc;
+    if (op == OP_GOTO || op == OP_GOSUB || op == OP_RUN) {
+      uint16_t line = read_u16(pc + 1);
+      const uint8_t *target = vm->code;
+      if (op != OP_RUN || line != 0xFFFF) {
+        target = vm_find_line(vm, line);
+      }
+      if (target) {
+        *pc = (op == OP_GOSUB) ? OP_CALL : OP_JMP;
+        write_u16(pc + 1, (uint16_t)(target - vm->code));
+      }
     }
-    *jump_line = (uint16_t)line;
-    return 0;
+    pc += op_length(pc);
   }
-  return exec_statement(vm, s, current_line, next_line, jump_ptr, jump_line,
-                        stop);
 }
 
-static int exec_statement(zx80_basic_t *vm, const char *s,
-                          const uint8_t *current_line,
-                          const uint8_t *next_line,
-                          const uint8_t **jump_ptr, uint16_t *jump_line,
-                          int *stop) {
-  (void)current_line;
-  s = skip_ws(s);
-  if (*s == '\0') {
-    return 0;
+static int vm_compile(zx80_basic_t *vm) {
+  size_t lines = 0;
+  const uint8_t *p = vm->ram;
+  while (p < vm->ram + vm->prog_end) {
+    lines++;
+    p += 4 + read_u16(p + 2);
   }
-  const char *kw = match_kw(s, "REM");
-  if (kw) {
+  vm->code_state = CODE_NO_FIT;
+  if (vm->code_size > 0xFFFF || lines * 4 + 1 > vm->code_size) {
     return 0;
   }
-  kw = match_kw(s, "PRINT");
-  if (kw) {
-    s = kw;
-    return exec_print(vm, s);
-  }
-  kw = match_kw(s, "LET");
-  if (kw) {
-    s = kw;
-    return exec_let(vm, s);
-  }
-  kw = match_kw(s, "INPUT");
-  if (kw) {
-    s = kw;
-    return exec_input(vm, s);
-  }
-  kw = match_kw(s, "GOTO");
-  if (kw) {
-    s = kw;
-    zx80_int line = 0;
-    s = parse_int(s, &line);
-    if (!s) {
-      return -1;
+  vm->code_lines = lines;
+  compiler_t c;
+  c.vm = vm;
+  c.out = vm->code;
+  c.fixups = (uint8_t *)line_table(vm);
+  fixups_keep(&c, 0);
+  c.fail = 0;
+  uint8_t *table = c.fixups;
+  p = vm->ram;
+  while (p < vm->ram + vm->prog_end && !c.fail) {
+    write_u16(table, read_u16(p));
+    write_u16(table + 2, (uint16_t)(c.out - vm->code));
+    table += 4;
+    emit_u8(&c, OP_LINE);
+    c.eol_chain = 0xFFFF;
+    const char *s = (const char *)(p + 4);
+    while (!c.fail) {
+      c.depth = 0;
+      c.stmt = s;
+      if (!compile_statement(&c, s)) {
+        break;
+      }
+      // Zero-trip FORs waiting on this NEXT exit to the next statement.
+      uint16_t here = (uint16_t)(c.out - vm->code);
+      int kept = 0;
+      for (int i = 0; i < c.fixup_count; i++) {
+        for_fixup_t f = fixup_get(&c, i);
+        if (f.next == s) {
+          write_u16(vm->code + f.patch, here);
+        } else {
+          fixup_put(&c, kept++, &f);
+        }
+      }
+      fixups_keep(&c, kept);
+      s = stmt_next(s);
+      if (*s == '\0') {
+        break;
+      }
     }
-    if (line < 0 || line > 65535) {
-      return -1;
+    uint16_t here = (uint16_t)(c.out - vm->code);
+    while (c.eol_chain != 0xFFFF && !c.fail) {
+      uint16_t link = read_u16(vm->code + c.eol_chain);
+      write_u16(vm->code + c.eol_chain, here);
+      c.eol_chain = link;
     }
-    *jump_line = (uint16_t)line;
-    return 0;
+    p += 4 + read_u16(p + 2);
   }
-  kw = match_kw(s, "IF");
-  if (kw) {
-    s = kw;
-    return exec_if(vm, s, current_line, next_line, jump_ptr, jump_line, stop);
-  }
-  kw = match_kw(s, "END");
-  if (kw) {
-    *stop = 1;
-    vm->cont_ptr = NULL;
+  emit_u8(&c, OP_HALT);
+  if (c.fail) {
     return 0;
   }
-  kw = match_kw(s, "STOP");
-  if (kw) {
-    *stop = 1;
-    if (next_line) {
-      vm->cont_ptr = next_line;
-    }
+  vm->code_end = (size_t)(c.out - vm->code);
+  vm_link(vm);
+  vm->code_state = CODE_READY;
+  return 1;
+}
+
+// Returns 1 when the bytecode image is ready, 0 when the program has to run
+// on the reference engine (always for a paged program).
+static int vm_prepare(zx80_basic_t *vm) {
+  if (!vm->code || vm->pager.read) {
     return 0;
   }
-  kw = match_kw(s, "RUN");
-  if (kw) {
-    s = kw;
-    s = skip_ws(s);
-    if (*s) {
-      zx80_int line = 0;
-      s = parse_int(s, &line);
-      if (!s || line < 0 || line > 65535) {
-        return -1;
-      }
-      *jump_line = (uint16_t)line;
-    } else {
-      *jump_line = 0xFFFF;
-    }
-    return 1;
+  if (vm->code_state == CODE_STALE) {
+    return vm_compile(vm);
   }
-  kw = match_kw(s, "LIST");
-  if (kw) {
-    list_program(vm);
-    return 0;
+  return vm->code_state == CODE_READY;
+}
+
+static uint8_t *vm_array_cell(zx80_basic_t *vm, int var, int dims,
+                              zx80_int i, zx80_int j, zx80_array_t **out) {
+  zx80_array_t *arr = find_array(vm, var);
+  if (!arr || arr->dims != dims) {
+    return NULL;
   }
-  kw = match_kw(s, "NEW");
-  if (kw) {
-    zx80_basic_reset(vm);
-    return 0;
+  *out = arr;
+  return array_at(vm, arr, NUM_TO_INT(i), NUM_TO_INT(j));
+}
+
+// Opcode dispatch. With ZX80_BASIC_THREADED each handler ends in an indirect
+// jump through a label table (GCC computed goto), so every handler gets its
+// own branch-predictor slot and there is no bounds check or loop back-edge;
+// otherwise the handlers are the cases of a portable switch.
+#if ZX80_BASIC_THREADED
+#define VM_CASE(op) do_##op:
+#define VM_NEXT \
+  do { \
+    op_pc = pc; \
+    goto *dispatch[*pc++]; \
+  } while (0)
+#define VM_DISPATCH VM_NEXT;
+#define VM_DISPATCH_END
+#else
+#define VM_CASE(op) case op:
+#define VM_NEXT continue
+#define VM_DISPATCH \
+  for (;;) { \
+    op_pc = pc; \
+    switch (*pc++) {
+#define VM_DISPATCH_END \
+    default: \
+      goto error; \
+    } \
   }
-  kw = match_kw(s, "CLS");
-  if (kw) {
-    for (int i = 0; i < 8; ++i) {
-      write_newline(vm);
-    }
-    return 0;
+#endif
+// The bytecode engine counts a step per line and per FOR loop iteration;
+// without a budget the count just wraps. The hint keeps the suspend path
+// out of the way of the dispatch code.
+#if defined(__GNUC__)
+#define VM_UNLIKELY(x) __builtin_expect(!!(x), 0)
+#else
+#define VM_UNLIKELY(x) (x)
+#endif
+#define VM_STEP(at) \
+  if (VM_UNLIKELY(!--steps) && vm->step_left) { \
+    vm->run_pc = (at); \
+    vm->run_state = ZX80_RUNNING; \
+    return 0; \
   }
-  kw = match_kw(s, "CONTINUE");
-  if (!kw) {
-    kw = match_kw(s, "CONT");
+// Break polls (see break_poll) come at the same places as steps, so a loop
+// on one line can be broken into too; polls counts down to the next one.
+#define VM_POLL(at) \
+  if (!--polls || vm->poll_now) { \
+    polls = vm->fast ? ZX80_BASIC_FAST_POLL : 1; \
+    vm->poll_now = 0; \
+    if (vm->out_len) { \
+      out_flush(vm); \
+    } \
+    if (vm->io.break_check && vm->io.break_check(vm->io.user)) { \
+      vm->cont_ptr = (at); \
+      write_str(vm, "BREAK"); \
+      write_newline(vm); \
+      return 0; \
+    } \
   }
-  if (kw) {
-    if (!vm->cont_ptr) {
-      return -1;
-    }
-    if (jump_ptr) {
-      *jump_ptr = vm->cont_ptr;
-    }
+#define VM_IF(op, rel) \
+  VM_CASE(op) \
+  if (vm->vars[pc[0]] rel NUM_FROM_INT(read_u16(pc + 1))) { \
+    pc += 5; \
+  } else { \
+    pc = vm->code + read_u16(pc + 3); \
+  } \
+  VM_NEXT;
+
+static int vm_run(zx80_basic_t *vm, const uint8_t *pc) {
+  vm->cont_ptr = NULL;
+  zx80_int stack[ZX80_BASIC_EVAL_DEPTH];
+  zx80_int *sp = stack;
+  const uint8_t *op_pc = pc;
+  uint8_t *cell = NULL;
+  zx80_array_t *arr = NULL;
+  int next_idx = 0;
+  uint32_t steps = vm->step_left; // kept in a register
+  uint32_t polls = 1;
+#if ZX80_BASIC_THREADED
+  static const void *const dispatch[OP_COUNT] = {
+    [OP_HALT] = &&do_OP_HALT,
+    [OP_LINE] = &&do_OP_LINE,
+    [OP_PUSH8] = &&do_OP_PUSH8,
+    [OP_PUSH16] = &&do_OP_PUSH16,
+    [OP_PUSH32] = &&do_OP_PUSH32,
+    [OP_LOAD] = &&do_OP_LOAD,
+    [OP_STORE] = &&do_OP_STORE,
+    [OP_LOADA1] = &&do_OP_LOADA1,
+    [OP_LOADA2] = &&do_OP_LOADA2,
+    [OP_STOREA1] = &&do_OP_STOREA1,
+    [OP_STOREA2] = &&do_OP_STOREA2,
+    [OP_NEG] = &&do_OP_NEG,
+    [OP_ADD] = &&do_OP_ADD,
+    [OP_SUB] = &&do_OP_SUB,
+    [OP_MUL] = &&do_OP_MUL,
+    [OP_DIV] = &&do_OP_DIV,
+    [OP_EQ] = &&do_OP_EQ,
+    [OP_NE] = &&do_OP_NE,
+    [OP_LT] = &&do_OP_LT,
+    [OP_GT] = &&do_OP_GT,
+    [OP_LE] = &&do_OP_LE,
+    [OP_GE] = &&do_OP_GE,
+    [OP_RND] = &&do_OP_RND,
+    [OP_PEEK] = &&do_OP_PEEK,
+    [OP_PRINT_NUM] = &&do_OP_PRINT_NUM,
+    [OP_PRINT_STR] = &&do_OP_PRINT_STR,
+    [OP_PRINT_SP] = &&do_OP_PRINT_SP,
+    [OP_PRINT_NL] = &&do_OP_PRINT_NL,
+    [OP_POKE] = &&do_OP_POKE,
+    [OP_JZ] = &&do_OP_JZ,
+    [OP_JMP] = &&do_OP_JMP,
+    [OP_CALL] = &&do_OP_CALL,
+    [OP_GOTO_DYN] = &&do_OP_GOTO_DYN,
+    [OP_GOSUB_DYN] = &&do_OP_GOSUB_DYN,
+    [OP_RETURN] = &&do_OP_RETURN,
+    [OP_FOR] = &&do_OP_FOR,
+    [OP_NEXT] = &&do_OP_NEXT,
+    [OP_END] = &&do_OP_END,
+    [OP_STOP] = &&do_OP_STOP,
+    [OP_CONT] = &&do_OP_CONT,
+    [OP_EXEC] = &&do_OP_EXEC,
+    [OP_IF_EQ] = &&do_OP_IF_EQ,
+    [OP_IF_NE] = &&do_OP_IF_NE,
+    [OP_IF_LT] = &&do_OP_IF_LT,
+    [OP_IF_GT] = &&do_OP_IF_GT,
+    [OP_IF_LE] = &&do_OP_IF_LE,
+    [OP_IF_GE] = &&do_OP_IF_GE,
+    [OP_ADDK] = &&do_OP_ADDK,
+    [OP_SUBK] = &&do_OP_SUBK,
+    [OP_NEXT_UP] = &&do_OP_NEXT_UP,
+    [OP_NEXT_DOWN] = &&do_OP_NEXT_DOWN,
+    [OP_AND] = &&do_OP_AND,
+    [OP_OR] = &&do_OP_OR,
+    [OP_NOT] = &&do_OP_NOT,
+    [OP_AND_SKIP] = &&do_OP_AND_SKIP,
+    [OP_OR_SKIP] = &&do_OP_OR_SKIP,
+    [OP_SUM] = &&do_OP_SUM,
+    [OP_USR] = &&do_OP_USR,
+    [OP_EVAL] = &&do_OP_EVAL,
+    [OP_GOTO] = &&do_OP_GOTO,
+    [OP_GOSUB] = &&do_OP_GOSUB,
+    [OP_RUN] = &&do_OP_RUN,
+  };
+#endif
+  VM_POLL(pc); // a resumed program may be inside a one-line loop
+  VM_DISPATCH
+  VM_CASE(OP_HALT)
     return 0;
-  }
-  kw = match_kw(s, "GOSUB");
-  if (kw) {
-    if (!next_line) {
-      return -1;
+  VM_CASE(OP_LINE)
+    VM_POLL(op_pc);
+    VM_STEP(op_pc);
+    VM_NEXT;
+  VM_CASE(OP_PUSH8)
+    *sp++ = *pc++;
+    VM_NEXT;
+  VM_CASE(OP_PUSH16)
+    *sp++ = read_u16(pc);
+    pc += 2;
+    VM_NEXT;
+  VM_CASE(OP_PUSH32)
+    *sp++ = (zx80_int)read_u32(pc);
+    pc += 4;
+    VM_NEXT;
+  VM_CASE(OP_LOAD)
+    *sp++ = vm->vars[*pc++];
+    VM_NEXT;
+  VM_CASE(OP_STORE)
+    vm->vars[*pc++] = *--sp;
+    VM_NEXT;
+  VM_CASE(OP_LOADA1)
+    cell = vm_array_cell(vm, *pc++, 1, sp[-1], 0, &arr);
+    if (!cell) {
+      goto error;
     }
-    s = kw;
-    zx80_int line = 0;
-    s = parse_int(s, &line);
-    if (!s || line < 0 || line > 65535) {
-      return -1;
+    sp[-1] = cell_load(arr, cell);
+    VM_NEXT;
+  VM_CASE(OP_LOADA2)
+    sp--;
+    cell = vm_array_cell(vm, *pc++, 2, sp[-1], sp[0], &arr);
+    if (!cell) {
+      goto error;
     }
-    if (vm->gosub_sp >= ZX80_BASIC_GOSUB_DEPTH) {
-      return -1;
+    sp[-1] = cell_load(arr, cell);
+    VM_NEXT;
+  VM_CASE(OP_STOREA1)
+    sp -= 2;
+    cell = vm_array_cell(vm, *pc++, 1, sp[0], 0, &arr);
+    if (!cell) {
+      goto error;
     }
-    vm->gosub_stack[vm->gosub_sp++] = next_line;
-    *jump_line = (uint16_t)line;
-    return 0;
-  }
-  kw = match_kw(s, "RETURN");
-  if (kw) {
-    if (vm->gosub_sp <= 0) {
-      return -1;
+    cell_store(arr, cell, sp[1]);
+    VM_NEXT;
+  VM_CASE(OP_STOREA2)
+    sp -= 3;
+    cell = vm_array_cell(vm, *pc++, 2, sp[0], sp[1], &arr);
+    if (!cell) {
+      goto error;
     }
-    if (jump_ptr) {
-      *jump_ptr = vm->gosub_stack[--vm->gosub_sp];
+    cell_store(arr, cell, sp[2]);
+    VM_NEXT;
+  VM_CASE(OP_NEG)
+    sp[-1] = (zx80_int)(0u - (uint32_t)sp[-1]);
+    VM_NEXT;
+  VM_CASE(OP_ADD)
+    sp--;
+    sp[-1] = sp[-1] + sp[0];
+    VM_NEXT;
+  VM_CASE(OP_SUB)
+    sp--;
+    sp[-1] = sp[-1] - sp[0];
+    VM_NEXT;
+  VM_CASE(OP_MUL)
+    sp--;
+    sp[-1] = NUM_MUL(sp[-1], sp[0]);
+    VM_NEXT;
+  VM_CASE(OP_DIV)
+    sp--;
+    sp[-1] = (sp[0] == 0) ? 0 : NUM_DIV(sp[-1], sp[0]);
+    VM_NEXT;
+  VM_CASE(OP_EQ)
+    sp--;
+    sp[-1] = (sp[-1] == sp[0]) ? NUM_TRUE : 0;
+    VM_NEXT;
+  VM_CASE(OP_NE)
+    sp--;
+    sp[-1] = (sp[-1] != sp[0]) ? NUM_TRUE : 0;
+    VM_NEXT;
+  VM_CASE(OP_LT)
+    sp--;
+    sp[-1] = (sp[-1] < sp[0]) ? NUM_TRUE : 0;
+    VM_NEXT;
+  VM_CASE(OP_GT)
+    sp--;
+    sp[-1] = (sp[-1] > sp[0]) ? NUM_TRUE : 0;
+    VM_NEXT;
+  VM_CASE(OP_LE)
+    sp--;
+    sp[-1] = (sp[-1] <= sp[0]) ? NUM_TRUE : 0;
+    VM_NEXT;
+  VM_CASE(OP_GE)
+    sp--;
+    sp[-1] = (sp[-1] >= sp[0]) ? NUM_TRUE : 0;
+    VM_NEXT;
+  VM_CASE(OP_AND)
+    sp--;
+    sp[-1] = NUM_AND(sp[-1], sp[0]);
+    VM_NEXT;
+  VM_CASE(OP_OR)
+    sp--;
+    sp[-1] = NUM_OR(sp[-1], sp[0]);
+    VM_NEXT;
+  VM_CASE(OP_NOT)
+    sp[-1] = NUM_NOT(sp[-1]);
+    VM_NEXT;
+  VM_CASE(OP_AND_SKIP)
+    pc = (sp[-1] == 0) ? vm->code + read_u16(pc) : pc + 2;
+    VM_NEXT;
+  VM_CASE(OP_OR_SKIP)
+    pc = (sp[-1] == NUM_TRUE) ? vm->code + read_u16(pc) : pc + 2;
+    VM_NEXT;
+  VM_CASE(OP_RND)
+    sp[-1] = rand_next(vm, sp[-1]);
+    VM_NEXT;
+  VM_CASE(OP_USR) {
+    int argc = pc[1] & 0x7F;
+    zx80_int result = 0;
+    sp -= argc;
+    if (native_call(vm, pc[0], sp, argc, pc[2], &result) != 0) {
+      goto error;
     }
-    return 0;
+    if (!(pc[1] & 0x80)) {
+      *sp++ = result;
+    }
+    pc += 3;
+    VM_NEXT;
   }
-  kw = match_kw(s, "FOR");
-  if (kw) {
-    if (!next_line) {
-      return -1;
+  VM_CASE(OP_EVAL) {
+    zx80_int v = 0;
+    if (!parse_expr(vm, (const char *)(vm->ram + read_u16(pc)), &v)) {
+      goto error;
     }
-    s = kw;
-    int idx = 0;
-    s = parse_var(s, &idx);
-    if (!s) {
-      return -1;
+    *sp++ = v;
+    pc += 2;
+    VM_NEXT;
+  }
+  VM_CASE(OP_SUM) {
+    size_t n = 0;
+    arr = find_array(vm, *pc++);
+    cell = array_cells(vm, arr, &n);
+    if (!cell) {
+      goto error;
     }
-    s = skip_ws(s);
-    if (*s != '=') {
-      return -1;
+    *sp++ = array_sum(arr, cell, n);
+    VM_NEXT;
+  }
+  VM_CASE(OP_PEEK) {
+    zx80_int addr = NUM_TO_INT(sp[-1]);
+    if (addr < 0 || (size_t)addr >= vm->ram_size) {
+      sp[-1] = 0;
+    } else {
+      sp[-1] = NUM_FROM_INT(vm->ram[addr]);
     }
-    s++;
-    zx80_int start = 0;
-    s = parse_expr(vm, s, &start);
-    if (!s) {
-      return -1;
+    VM_NEXT;
+  }
+  VM_CASE(OP_PRINT_NUM)
+    write_num(vm, *--sp);
+    VM_NEXT;
+  VM_CASE(OP_PRINT_STR) {
+    uint8_t len = *pc++;
+    write_mem(vm, (const char *)pc, len);
+    pc += len;
+    VM_NEXT;
+  }
+  VM_CASE(OP_PRINT_SP)
+    write_char(vm, ' ');
+    VM_NEXT;
+  VM_CASE(OP_PRINT_NL)
+    write_newline(vm);
+    VM_NEXT;
+  VM_CASE(OP_POKE) {
+    sp -= 2;
+    poke(vm, NUM_TO_INT(sp[0]), NUM_TO_INT(sp[1]));
+    VM_NEXT;
+  }
+  VM_CASE(OP_JZ)
+    if (*--sp == 0) {
+      pc = vm->code + read_u16(pc);
+    } else {
+      pc += 2;
     }
-    s = skip_ws(s);
-    const char *to_kw = match_kw(s, "TO");
-    if (!to_kw) {
-      return -1;
+    VM_NEXT;
+  VM_IF(OP_IF_EQ, ==)
+  VM_IF(OP_IF_NE, !=)
+  VM_IF(OP_IF_LT, <)
+  VM_IF(OP_IF_GT, >)
+  VM_IF(OP_IF_LE, <=)
+  VM_IF(OP_IF_GE, >=)
+  VM_CASE(OP_ADDK)
+    vm->vars[pc[0]] += NUM_FROM_INT(read_u16(pc + 1));
+    pc += 3;
+    VM_NEXT;
+  VM_CASE(OP_SUBK)
+    vm->vars[pc[0]] -= NUM_FROM_INT(read_u16(pc + 1));
+    pc += 3;
+    VM_NEXT;
+  VM_CASE(OP_JMP)
+    pc = vm->code + read_u16(pc);
+    VM_NEXT;
+  VM_CASE(OP_CALL)
+    if (gosub_push(vm, pc + 2) != 0) {
+      goto error;
     }
-    s = to_kw;
-    zx80_int end = 0;
-    s = parse_expr(vm, s, &end);
-    if (!s) {
-      return -1;
+    pc = vm->code + read_u16(pc);
+    VM_NEXT;
+  VM_CASE(OP_GOTO)
+  VM_CASE(OP_GOSUB)
+  VM_CASE(OP_RUN)
+    // Left by vm_link for a missing line.
+    handle_error(vm, "LINE NOT FOUND");
+    return -1;
+  VM_CASE(OP_GOTO_DYN)
+  VM_CASE(OP_GOSUB_DYN) {
+    zx80_int line = NUM_TO_INT(*--sp);
+    if (line < 0 || line > 65535) {
+      goto error;
     }
-    zx80_int step = 1;
-    s = skip_ws(s);
-    kw = match_kw(s, "STEP");
-    if (kw) {
-      s = kw;
-      s = parse_expr(vm, s, &step);
-      if (!s) {
-        return -1;
+    if (*op_pc == OP_GOSUB_DYN) {
+      if (gosub_push(vm, pc) != 0) {
+        goto error;
       }
     }
-    if (vm->for_sp >= ZX80_BASIC_FOR_DEPTH) {
+    pc = vm_find_line(vm, (uint16_t)line);
+    if (!pc) {
+      handle_error(vm, "LINE NOT FOUND");
       return -1;
     }
+    VM_NEXT;
+  }
+  VM_CASE(OP_RETURN)
+    if (vm->gosub_sp <= 0) {
+      goto error;
+    }
+    pc = vm->gosub_stack[--vm->gosub_sp];
+    VM_NEXT;
+  VM_CASE(OP_FOR) {
+    sp -= 3;
+    int idx = *pc++;
+    zx80_int start = sp[0];
+    zx80_int end = sp[1];
+    zx80_int step = sp[2];
     vm->vars[idx] = start;
     int run = (step >= 0) ? (start <= end) : (start >= end);
+    uint16_t exit = read_u16(pc);
+    pc += 2;
     if (!run) {
-      const uint8_t *scan = next_line;
-      int depth = 0;
-      while (scan && scan < vm->ram + vm->prog_end) {
-        uint16_t slen = read_u16(scan + 2);
-        const char *text = (const char *)(scan + 4);
-        const char *ts = skip_ws(text);
-        if (match_kw(ts, "FOR")) {
-          depth++;
-        } else if (match_kw(ts, "NEXT")) {
-          ts = match_kw(ts, "NEXT");
-          ts = skip_ws(ts);
-          int nidx = -1;
-          if (*ts) {
-            if (!parse_var(ts, &nidx)) {
-              return -1;
-            }
-          }
-          if (depth == 0 && (nidx < 0 || nidx == idx)) {
-            if (jump_ptr) {
-              *jump_ptr = scan + 4 + slen;
-            }
-            return 0;
-          }
-          if (depth > 0) {
-            depth--;
-          }
+      if (exit == 0xFFFF) {
+        goto error;
+      }
+      pc = vm->code + exit;
+      VM_NEXT;
+    }
+    zx80_for_frame_t *frame = for_push(vm);
+    if (!frame) {
+      goto error;
+    }
+    frame->var = idx;
+    frame->end = end;
+    frame->step = step;
+    frame->line_ptr = pc;
+    VM_NEXT;
+  }
+  VM_CASE(OP_NEXT_UP)
+  VM_CASE(OP_NEXT_DOWN) {
+    next_idx = pc[0];
+    zx80_int step = NUM_FROM_INT((*op_pc == OP_NEXT_UP) ? pc[1] : -pc[1]);
+    pc += 2;
+    if (vm->for_sp > 0) {
+      zx80_for_frame_t *frame = &vm->for_stack[vm->for_sp - 1];
+      if ((next_idx == 0xFF || frame->var == next_idx) &&
+          frame->step == step) {
+        zx80_int v = vm->vars[frame->var] += step;
+        if ((step > 0) ? (v <= frame->end) : (v >= frame->end)) {
+          pc = frame->line_ptr;
+          VM_POLL(pc);
+          VM_STEP(pc);
+        } else {
+          vm->for_sp--;
         }
-        scan += 4 + slen;
+        VM_NEXT;
       }
-      return -1;
     }
-    vm->for_stack[vm->for_sp].var = idx;
-    vm->for_stack[vm->for_sp].end = end;
-    vm->for_stack[vm->for_sp].step = step;
-    vm->for_stack[vm->for_sp].line_ptr = next_line;
-    vm->for_sp++;
-    return 0;
+    goto next_generic;
   }
-  kw = match_kw(s, "NEXT");
-  if (kw) {
+  VM_CASE(OP_NEXT)
+    next_idx = *pc++;
+  next_generic: {
     if (vm->for_sp <= 0) {
-      return -1;
-    }
-    s = kw;
-    s = skip_ws(s);
-    int idx = -1;
-    if (*s) {
-      s = parse_var(s, &idx);
-      if (!s) {
-        return -1;
-      }
+      goto error;
     }
     zx80_for_frame_t *frame = &vm->for_stack[vm->for_sp - 1];
-    if (idx >= 0 && frame->var != idx) {
-      return -1;
+    if (next_idx != 0xFF && frame->var != next_idx) {
+      goto error;
     }
-    vm->vars[frame->var] += frame->step;
-    zx80_int v = vm->vars[frame->var];
+    zx80_int v = vm->vars[frame->var] += frame->step;
     int cont = (frame->step >= 0) ? (v <= frame->end) : (v >= frame->end);
     if (cont) {
-      if (jump_ptr) {
-        *jump_ptr = frame->line_ptr;
-      }
+      pc = frame->line_ptr;
+      VM_POLL(pc);
+      VM_STEP(pc);
     } else {
       vm->for_sp--;
     }
+    VM_NEXT;
+  }
+  VM_CASE(OP_END)
+    vm->cont_ptr = NULL;
+    return 0;
+  VM_CASE(OP_STOP)
+    vm->cont_ptr = pc;
+    return 0;
+  VM_CASE(OP_CONT)
+    if (!vm->cont_ptr) {
+      goto error;
+    }
+    pc = vm->cont_ptr;
+    VM_NEXT;
+  VM_CASE(OP_EXEC) {
+    const char *text = (const char *)(vm->ram + read_u16(pc));
+    exec_ctx_t ctx;
+    pc += 2;
+    ctx.next_stmt = stmt_next(text);
+    ctx.resume = pc; // the next statement's code follows this OP_EXEC
+    ctx.jump_ptr = NULL;
+    ctx.jump_line = 0xFFFF;
+    ctx.stop = 0;
+    ctx.skip_line = 0;
+    int res = exec_statement(vm, text, &ctx);
+    if (res < 0) {
+      goto error;
+    }
+    if (ctx.jump_ptr && (ctx.jump_ptr < vm->code ||
+                         ctx.jump_ptr >= vm->code + vm->code_size)) {
+      goto error; // a zero-trip FOR exit, only found in the program text
+    }
+    if (ctx.stop || vm->code_state != CODE_READY) {
+      return 0;
+    }
+    if (ctx.jump_ptr) {
+      pc = ctx.jump_ptr;
+    } else if (res == 1 && ctx.jump_line == 0xFFFF) {
+      pc = vm->code;
+    } else if (ctx.jump_line != 0xFFFF) {
+      pc = vm_find_line(vm, ctx.jump_line);
+      if (!pc) {
+        handle_error(vm, "LINE NOT FOUND");
+        return -1;
+      }
+    } else if (ctx.skip_line) {
+      pc = vm_line_start(vm, vm_line_index(vm, op_pc) + 1);
+    }
+    VM_NEXT;
+  }
+  VM_DISPATCH_END
+error:
+  write_str(vm, "ERROR IN ");
+  write_int(vm, read_u16(line_table(vm) + vm_line_index(vm, op_pc) * 4));
+  write_newline(vm);
+  return -1;
+}
+
+#undef VM_IF
+#undef VM_STEP
+#undef VM_POLL
+#undef VM_UNLIKELY
+#undef VM_CASE
+#undef VM_NEXT
+#undef VM_DISPATCH
+#undef VM_DISPATCH_END
+#endif
+
+// Starts the stored program at line (0xFFFF = first line) on the bytecode
+// engine when the program fits in the code buffer, else on the reference one.
+static int resume_program(zx80_basic_t *vm, const uint8_t *pc) {
+  int res;
+  vm->run_state = ZX80_STOPPED;
+#if ZX80_BASIC_USE_VM
+  if (vm->code && pc >= vm->code && pc < vm->code + vm->code_size) {
+    res = vm_run(vm, pc);
+  } else
+#endif
+  {
+    res = exec_program_from(vm, (const char *)pc);
+  }
+  if (res < 0) {
+    vm->run_state = ZX80_ERROR;
+  }
+  out_flush(vm);
+  return res;
+}
+
+static int start_program(zx80_basic_t *vm, uint16_t line) {
+  stacks_clear(vm);
+  vm->run_state = ZX80_ERROR;
+#if ZX80_BASIC_USE_VM
+  if (vm_prepare(vm)) {
+    const uint8_t *pc = vm->code;
+    if (line != 0xFFFF) {
+      pc = vm_find_line(vm, line);
+      if (!pc) {
+        handle_error(vm, "LINE NOT FOUND");
+        return -1;
+      }
+    }
+    return resume_program(vm, pc);
+  }
+#endif
+  vm->page_error = 0;
+  const char *target = line_start(vm, line);
+  if (!target) {
+    handle_error(vm, vm->page_error ? "PAGE ERROR" : "LINE NOT FOUND");
+    return -1;
+  }
+  return resume_program(vm, (const uint8_t *)target);
+}
+
+// Starts a call into the program with the step budget of the VM; a program
+// left suspended by the previous call counts as broken into, so CONT goes on
+// with it.
+static void run_enter(zx80_basic_t *vm) {
+  if (vm->run_state == ZX80_RUNNING || vm->run_state == ZX80_WAITING_INPUT) {
+    vm->cont_ptr = vm->run_pc;
+  }
+  vm->run_state = ZX80_STOPPED;
+  vm->step_left = vm->step_budget ? vm->step_budget + 1 : 0;
+}
+
+// Gives a line to an INPUT waiting for it and goes on with the program.
+static int input_resume(zx80_basic_t *vm, const char *line) {
+  vm->run_state = ZX80_STOPPED;
+  if (input_assign(vm, vm->input_var, vm->input_str, line) != 0) {
+    handle_error(vm, "OUT OF MEMORY");
+    vm->run_state = ZX80_ERROR;
+    return -1;
+  }
+  if (!vm->run_pc) {
+    return 0;
+  }
+  vm->step_left = vm->step_budget ? vm->step_budget + 1 : 0;
+  return resume_program(vm, vm->run_pc);
+}
+
+int zx80_basic_step(zx80_basic_t *vm, uint32_t budget) {
+  if (vm->run_state != ZX80_RUNNING) {
+    return vm->run_state;
+  }
+  vm->step_left = budget ? budget + 1 : 0;
+  resume_program(vm, vm->run_pc);
+  return vm->run_state;
+}
+
+int zx80_basic_run(zx80_basic_t *vm) {
+  run_enter(vm);
+  program_close(vm);
+  int res = start_program(vm, 0xFFFF);
+  out_flush(vm);
+  return res;
+}
+
+enum { STORE_OK, STORE_BAD, STORE_NO_MEM };
+
+// Stores (or with no text deletes) the numbered program line at s.
+static int store_line(zx80_basic_t *vm, const char *s) {
+  zx80_int line_num = 0;
+  s = parse_int(s, &line_num);
+  if (!s || line_num < 0 || line_num > 65535) {
+    return STORE_BAD;
+  }
+  s = skip_ws(s);
+  if (*s == '\0') {
+    delete_line(vm, (uint16_t)line_num);
+    return STORE_OK;
+  }
+  uint8_t buf[ZX80_BASIC_LINE_MAX];
+  size_t len = 0;
+  int names = vm->var_count;
+  if (crunch_line(vm, s, buf, sizeof(buf), &len) != 0) {
+    names_trim(vm, names);
+    return STORE_BAD;
+  }
+  if (insert_line(vm, (uint16_t)line_num, buf, len) != 0) {
+    names_trim(vm, names);
+    return STORE_NO_MEM;
+  }
+  return STORE_OK;
+}
+
+// Copies the next line of a listing, trimmed, into text (ZX80_BASIC_LINE_MAX
+// bytes) and moves *pos past it. Returns 1 for a numbered line, 0 for a
+// blank one and -1 for anything else.
+static int listing_next(const char *buf, size_t len, size_t *pos, char *text) {
+  size_t start = *pos;
+  size_t end = start;
+  while (end < len && buf[end] != '\n') {
+    end++;
+  }
+  *pos = end + 1;
+  while (start < end && isspace((unsigned char)buf[start])) {
+    start++;
+  }
+  while (end > start && isspace((unsigned char)buf[end - 1])) {
+    end--;
+  }
+  if (start == end) {
     return 0;
   }
-  kw = match_kw(s, "POKE");
-  if (kw) {
-    s = kw;
-    zx80_int addr = 0;
-    s = parse_expr(vm, s, &addr);
-    if (!s) {
-      return -1;
+  if (end - start >= ZX80_BASIC_LINE_MAX ||
+      !isdigit((unsigned char)buf[start])) {
+    return -1;
+  }
+  memcpy(text, buf + start, end - start);
+  text[end - start] = '\0';
+  return 1;
+}
+
+static void report_line(zx80_basic_t *vm, const char *msg, int32_t n) {
+  write_str(vm, msg);
+  write_int(vm, n);
+  write_newline(vm);
+  out_flush(vm);
+}
+
+int zx80_basic_load_buffer(zx80_basic_t *vm, const char *buf, size_t len) {
+  zx80_basic_reset(vm);
+  char text[ZX80_BASIC_LINE_MAX];
+  int bad = 0;
+  int32_t n = 0;
+  size_t i = 0;
+  while (i < len) {
+    n++;
+    int got = listing_next(buf, len, &i, text);
+    if (got == 0) {
+      continue;
     }
-    s = skip_ws(s);
-    if (*s != ',') {
-      return -1;
+    int res = (got > 0) ? store_line(vm, text) : STORE_BAD;
+    if (res == STORE_OK) {
+      continue;
     }
-    s++;
-    zx80_int value = 0;
-    s = parse_expr(vm, s, &value);
-    if (!s) {
+    report_line(vm, res == STORE_NO_MEM ? "OUT OF MEMORY IN " : "BAD LINE IN ",
+                n);
+    if (res == STORE_NO_MEM) {
+      program_close(vm);
       return -1;
     }
-    if (addr >= 0 && (size_t)addr < vm->ram_size) {
-      vm->ram[addr] = (uint8_t)(value & 0xFF);
-    }
-    return 0;
+    bad++;
   }
-  kw = match_kw(s, "RANDOMISE");
-  if (!kw) {
-    kw = match_kw(s, "RAND");
+  program_close(vm);
+  return bad;
+}
+
+// Crunches a numbered line of a listing into stored form for a paged image;
+// lines must come in ascending order and cannot be deletions.
+static int page_crunch(zx80_basic_t *vm, const char *text, int32_t *prev,
+                       uint8_t *out, size_t *out_len) {
+  zx80_int line_num = 0;
+  const char *s = parse_int(text, &line_num);
+  if (!s || line_num <= *prev || line_num > 65535) {
+    return STORE_BAD;
   }
-  if (kw) {
-    s = kw;
-    s = skip_ws(s);
-    if (*s) {
-      zx80_int seed = 0;
-      s = parse_expr(vm, s, &seed);
-      if (!s) {
-        return -1;
-      }
-      vm->rand_state = (uint32_t)seed;
-    } else {
-      vm->rand_state = (uint32_t)(vm->prog_end + 1);
-    }
-    return 0;
+  s = skip_ws(s);
+  size_t len = 0;
+  int names = vm->var_count;
+  if (*s == '\0' ||
+      crunch_line(vm, s, out + 4, ZX80_BASIC_LINE_MAX, &len) != 0) {
+    names_trim(vm, names);
+    return STORE_BAD;
   }
-  kw = match_kw(s, "DIM");
-  if (kw) {
-    s = kw;
-    while (1) {
-      int idx = 0;
-      s = parse_var(s, &idx);
-      if (!s) {
+  write_u16(out, (uint16_t)line_num);
+  write_u16(out + 2, (uint16_t)len);
+  *out_len = 4 + len;
+  *prev = line_num;
+  return STORE_OK;
+}
+
+int zx80_basic_page_build(zx80_basic_t *vm, const char *buf, size_t len,
+                          zx80_page_write_fn write, void *user) {
+  zx80_basic_reset(vm);
+  char text[ZX80_BASIC_LINE_MAX];
+  uint8_t line[4 + ZX80_BASIC_LINE_MAX];
+  uint32_t count = 0;
+  uint32_t bytes = 0;
+  uint32_t names_len = 0;
+  int bad = 0;
+  // Pass 0 checks the lines and interns their names, pass 1 writes the
+  // header and lines and pass 2 the index.
+  for (int pass = 0; pass < 3; ++pass) {
+    if (pass == 1) {
+      uint8_t head[PAGE_HEADER];
+      names_len = (uint32_t)(names_end(vm) - vm->names_base);
+      memcpy(head, "ZXP1", 4);
+      write_u32(head + 4, count);
+      write_u32(head + 8, names_len);
+      write_u32(head + 12, bytes);
+      if (write(head, sizeof(head), user) != 0 ||
+          write(vm->ram + vm->names_base, names_len, user) != 0) {
         return -1;
       }
-      zx80_int size1 = 0;
-      zx80_int size2 = 0;
-      int dims = 0;
-      s = parse_indices(vm, s, &size1, &size2, &dims);
-      if (!s) {
-        return -1;
+    }
+    uint32_t off = PAGE_HEADER + names_len;
+    int32_t prev = -1;
+    int32_t n = 0;
+    size_t i = 0;
+    while (i < len) {
+      n++;
+      int got = listing_next(buf, len, &i, text);
+      if (got == 0) {
+        continue;
       }
-      if (size1 < 0 || size2 < 0) {
-        return -1;
+      size_t size = 0;
+      if (got < 0 || page_crunch(vm, text, &prev, line, &size) != STORE_OK) {
+        if (pass == 0) {
+          report_line(vm, "BAD LINE IN ", n);
+          bad++;
+        }
+        continue;
       }
-      zx80_array_t *arr = find_array(vm, idx);
-      if (!arr) {
-        if (vm->array_count >= ZX80_BASIC_MAX_ARRAYS) {
+      if (pass == 0) {
+        count++;
+        bytes += (uint32_t)size;
+      } else if (pass == 1) {
+        if (write(line, size, user) != 0) {
           return -1;
         }
-        arr = &vm->arrays[vm->array_count++];
-        memset(arr, 0, sizeof(*arr));
-        arr->var = idx;
-      } else if (arr->dims != dims || arr->size1 != size1 ||
-                 arr->size2 != (dims == 2 ? size2 : 0)) {
-        return -1;
-      }
-      arr->dims = dims;
-      arr->size1 = size1;
-      arr->size2 = (dims == 2) ? size2 : 0;
-      if (!vm->array_mem || vm->array_mem_size == 0) {
-        return -1;
-      }
-      size_t count = (size_t)(size1 + 1) * (size_t)(arr->size2 + 1);
-      size_t need = count * sizeof(zx80_int);
-      if (arr->bytes == 0) {
-        size_t start = align_up(vm->array_mem_used, sizeof(zx80_int));
-        if (start + need > vm->array_mem_size) {
+      } else {
+        uint8_t e[PAGE_ENTRY];
+        write_u16(e, read_u16(line));
+        write_u32(e + 2, off);
+        if (write(e, sizeof(e), user) != 0) {
           return -1;
         }
-        arr->offset = start;
-        arr->bytes = need;
-        vm->array_mem_used = start + need;
-      } else if (arr->bytes != need) {
-        return -1;
-      }
-      memset(vm->array_mem + arr->offset, 0, arr->bytes);
-      s = skip_ws(s);
-      if (*s != ',') {
-        break;
       }
-      s++;
+      off += (uint32_t)size;
     }
-    return 0;
   }
-  kw = match_kw(s, "LOAD");
-  if (!kw) {
-    kw = match_kw(s, "SAVE");
+  return bad;
+}
+
+int zx80_basic_page_open(zx80_basic_t *vm, zx80_pager_t pager, uint8_t *cache,
+                         size_t cache_size) {
+  uint8_t head[PAGE_HEADER];
+  size_t count = cache_size / ZX80_BASIC_PAGE_SIZE;
+  if (!pager.read || !cache || count < 2 ||
+      pager.read(0, head, sizeof(head), pager.user) != sizeof(head) ||
+      memcmp(head, "ZXP1", 4) != 0) {
+    return -1;
   }
-  if (kw) {
-    return 0;
+  zx80_basic_reset(vm);
+  uint32_t names_len = read_u32(head + 8);
+  uint32_t off = PAGE_HEADER;
+  for (int slot = VAR_LETTERS; off < PAGE_HEADER + names_len; ++slot) {
+    uint8_t name[1 + 0xFF];
+    if (pager.read(off, name, 1, pager.user) != 1 || name[0] == 0 ||
+        pager.read(off + 1, name + 1, name[0], pager.user) != name[0] ||
+        intern_var(vm, (const char *)name + 1, name[0]) != slot) {
+      zx80_basic_reset(vm);
+      return -1;
+    }
+    off += 1 + name[0];
   }
+  vm->pager = pager;
+  vm->page_mem = cache;
+  vm->page_count = (int)(count < ZX80_BASIC_MAX_PAGES ? count
+                                                      : ZX80_BASIC_MAX_PAGES);
+  memset(vm->pages, 0, sizeof(vm->pages));
+  vm->page_clock = 0;
+  vm->page_lines = read_u32(head + 4);
+  vm->page_first = off;
+  vm->page_index = off + read_u32(head + 12);
+  return 0;
+}
 
-  if (is_name_char(*s)) {
-    const char *p = s;
-    int idx = 0;
-    p = parse_var(p, &idx);
-    if (p) {
-      const char *q = skip_ws(p);
-      if (q[0] == '=' || q[0] == '(') {
-        return exec_let(vm, s);
-      }
-    }
+// Snapshot image: "ZX80", a u32 version word, the u32 image length, then the
+// program, names and variables, the resume point and INPUT target, arrays,
+// FOR and GOSUB frames and strings.
+// Counts and scalars are little-endian u32; variable and array cells are
+// copied in the device byte order. Pointers are stored as SNAP_PTR_* tagged
+// offsets + 1 (0 for none) into the program or the bytecode, so the image
+// does not depend on where the buffers live.
+#define SNAP_VERSION 2
+#define SNAP_FIXED 0x10000u
+#define SNAP_PTR_CODE 0x80000000u
+#define SNAP_HEADER 12
+
+typedef struct {
+  uint8_t *buf;
+  size_t max;
+  size_t len;
+} snap_out_t;
+
+typedef struct {
+  const uint8_t *p;
+  const uint8_t *end;
+  int fail;
+} snap_in_t;
+
+static void snap_put(snap_out_t *o, const void *data, size_t n) {
+  if (o->buf && o->len + n <= o->max) {
+    memcpy(o->buf + o->len, data, n);
   }
-  return -1;
+  o->len += n;
 }
 
-void zx80_basic_init(zx80_basic_t *vm, uint8_t *ram, size_t ram_size,
-                     zx80_io_t io) {
-  memset(vm, 0, sizeof(*vm));
-  vm->ram = ram;
-  vm->ram_size = ram_size;
-  vm->io = io;
-  vm->rand_state = 1;
-  vm->array_mem = NULL;
-  vm->array_mem_size = 0;
-  vm->array_mem_used = 0;
-  vm->array_count = 0;
+static void snap_put_u32(snap_out_t *o, uint32_t v) {
+  uint8_t b[4];
+  write_u32(b, v);
+  snap_put(o, b, 4);
 }
 
-void zx80_basic_init_default(zx80_basic_t *vm, zx80_io_t io) {
-  zx80_basic_init(vm, default_ram, sizeof(default_ram), io);
-  vm->array_mem = default_array_mem;
-  vm->array_mem_size = sizeof(default_array_mem);
+static void snap_put_ptr(snap_out_t *o, zx80_basic_t *vm, const uint8_t *p) {
+  uint32_t v = 0;
+#if ZX80_BASIC_USE_VM
+  if (p && vm->code && p >= vm->code && p < vm->code + vm->code_size) {
+    v = SNAP_PTR_CODE | (uint32_t)(p - vm->code + 1);
+  }
+#endif
+  if (p && p >= vm->ram && p <= vm->ram + vm->prog_end) {
+    v = (uint32_t)(p - vm->ram + 1);
+  }
+  snap_put_u32(o, v);
 }
 
-void zx80_basic_reset(zx80_basic_t *vm) {
-  vm->prog_end = 0;
-  memset(vm->vars, 0, sizeof(vm->vars));
-  vm->gosub_sp = 0;
-  vm->for_sp = 0;
-  vm->cont_ptr = NULL;
-  vm->rand_state = 1;
-  vm->array_count = 0;
-  vm->array_mem_used = 0;
+static const uint8_t *snap_get(snap_in_t *in, size_t n) {
+  const uint8_t *p = in->p;
+  if (in->fail || (size_t)(in->end - in->p) < n) {
+    in->fail = 1;
+    return NULL;
+  }
+  in->p += n;
+  return p;
 }
 
-void zx80_basic_list(zx80_basic_t *vm) {
-  list_program(vm);
+// Takes count records of size bytes. The count is checked against what is
+// left of the image before multiplying, so a huge one cannot wrap a 32-bit
+// size_t into a small read, and it must fit the int it is kept in.
+static const uint8_t *snap_get_n(snap_in_t *in, uint32_t count, size_t size) {
+  if (count > INT_MAX || count > (size_t)(in->end - in->p) / size) {
+    in->fail = 1;
+    return NULL;
+  }
+  return snap_get(in, count * size);
 }
 
-static int exec_program_from(zx80_basic_t *vm, uint8_t *start_pc) {
-  vm->cont_ptr = NULL;
-  vm->gosub_sp = 0;
-  vm->for_sp = 0;
-  uint8_t *pc = start_pc;
-  while (pc < vm->ram + vm->prog_end) {
-    if (vm->io.break_check && vm->io.break_check(vm->io.user)) {
-      uint16_t len = read_u16(pc + 2);
-      vm->cont_ptr = pc + 4 + len;
-      write_str(vm, "BREAK");
-      write_newline(vm);
-      return 0;
-    }
-    uint16_t line = read_u16(pc);
-    uint16_t len = read_u16(pc + 2);
-    const char *text = (const char *)(pc + 4);
+static uint32_t snap_get_u32(snap_in_t *in) {
+  const uint8_t *p = snap_get(in, 4);
+  return p ? read_u32(p) : 0;
+}
 
-    uint16_t jump_line = 0xFFFF;
-    const uint8_t *jump_ptr = NULL;
-    int stop = 0;
-    uint8_t *next_line = pc + 4 + len;
-    int res = exec_statement(vm, text, pc, next_line, &jump_ptr, &jump_line,
-                             &stop);
-    if (res < 0) {
-      write_str(vm, "ERROR IN ");
-      write_int(vm, line);
-      write_newline(vm);
+// Checks the stored lines of an image: each fits, numbers ascend, the text
+// ends with a NUL at its length, operands stay inside it and variables name
+// existing slots. Returns the number of lines, or -1.
+static int32_t snap_check_program(const uint8_t *prog, size_t prog_end,
+                                  uint32_t var_count) {
+  size_t off = 0;
+  int32_t prev = -1;
+  int32_t count = 0;
+  if (prog_end > PROG_MAX) {
+    return -1;
+  }
+  while (off < prog_end) {
+    if (prog_end - off < 5) {
       return -1;
     }
-    if (stop) {
-      return 0;
+    const uint8_t *p = prog + off;
+    size_t len = read_u16(p + 2);
+    if ((int32_t)read_u16(p) <= prev || len == 0 ||
+        len > prog_end - off - 4 || p[4 + len - 1] != '\0') {
+      return -1;
     }
-    if (res == 1) {
-      if (jump_line != 0xFFFF) {
-        uint8_t *target = find_line(vm, jump_line, NULL);
-        if (!target) {
-          handle_error(vm, "LINE NOT FOUND");
+    prev = read_u16(p);
+    const uint8_t *t = p + 4;
+    const uint8_t *end = t + len - 1;
+    while (t < end) {
+      size_t n = 1;
+      switch (*t) {
+      case TOK_REM:
+        n = (size_t)(end - t);
+        break;
+      case '"':
+        while (t + n < end && t[n] != '"') {
+          n++;
+        }
+        n += (t + n < end);
+        break;
+      case TOK_VAR:
+        n = 2;
+        if (t + 1 < end && t[1] >= var_count) {
           return -1;
         }
-        pc = target;
-      } else {
-        pc = vm->ram;
+        break;
+      case TOK_NUM8:
+        n = 2;
+        break;
+      case TOK_NUM16:
+        n = 3;
+        break;
+      case TOK_NUM32:
+      case TOK_FIX:
+        n = 5;
+        break;
+      default:
+        if (*t >= TOK_LAST) {
+          return -1;
+        }
+        break;
       }
-      continue;
-    }
-    if (jump_ptr) {
-      pc = (uint8_t *)jump_ptr;
-      continue;
-    }
-    if (jump_line != 0xFFFF) {
-      uint8_t *target = find_line(vm, jump_line, NULL);
-      if (!target) {
-        handle_error(vm, "LINE NOT FOUND");
+      if (n > (size_t)(end - t)) {
         return -1;
       }
-      pc = target;
-      continue;
+      t += n;
     }
-
-    pc += 4 + len;
+    off += 4 + len;
+    count++;
   }
-  return 0;
+  return count;
 }
 
-int zx80_basic_run(zx80_basic_t *vm) {
-  return exec_program_from(vm, vm->ram);
+// Is off where a statement, or the NUL ending a line, starts?
+static int snap_stmt_at(zx80_basic_t *vm, size_t off) {
+  for (const uint8_t *p = vm->ram; p < vm->ram + vm->prog_end;
+       p += 4 + read_u16(p + 2)) {
+    const char *s = (const char *)(p + 4);
+    while (1) {
+      if ((size_t)((const uint8_t *)s - vm->ram) == off) {
+        return 1;
+      }
+      if (!*s) {
+        break;
+      }
+      s = stmt_next(s);
+    }
+  }
+  return off == vm->prog_end;
 }
 
-int zx80_basic_handle_line(zx80_basic_t *vm, const char *line) {
-  if (!line) {
+// Turns a stored pointer back into one into this VM; -1 if it is invalid.
+// Bytecode pointers compile the restored program first.
+static int snap_ptr(zx80_basic_t *vm, uint32_t v, const uint8_t **out) {
+  *out = NULL;
+  if (v == 0) {
     return 0;
   }
-  const char *s = skip_ws(line);
-  if (*s == '\0') {
-    return 0;
+  size_t off = (size_t)(v & ~SNAP_PTR_CODE) - 1;
+  if (v & SNAP_PTR_CODE) {
+#if ZX80_BASIC_USE_VM
+    if (vm_prepare(vm) == 1) {
+      // Programs resume only between statements: at a line, or after the
+      // instruction that left the resume point (FOR, GOSUB, STOP, OP_EXEC).
+      uint8_t prev = OP_HALT;
+      for (const uint8_t *pc = vm->code; pc < vm->code + vm->code_end;
+           pc += op_length(pc)) {
+        if (pc == vm->code + off &&
+            (*pc == OP_LINE || *pc == OP_HALT || prev == OP_FOR ||
+             prev == OP_CALL || prev == OP_GOSUB_DYN || prev == OP_STOP ||
+             prev == OP_EXEC)) {
+          *out = pc;
+          return 0;
+        }
+        prev = *pc;
+      }
+    }
+#endif
+    return -1;
+  }
+  if (!snap_stmt_at(vm, off)) {
+    return -1;
   }
+  *out = vm->ram + off;
+  return 0;
+}
 
-  if (isdigit((unsigned char)*s)) {
-    zx80_int line_num = 0;
-    const char *ns = parse_int(s, &line_num);
-    if (!ns || line_num < 0 || line_num > 65535) {
-      handle_error(vm, "BAD LINE");
+size_t zx80_basic_snapshot(zx80_basic_t *vm, uint8_t *buf, size_t max) {
+  if (vm->pager.read) {
+    return 0; // the lines and the pointers into them are in the page cache
+  }
+  program_close(vm);
+  snap_out_t o = {buf, max, 0};
+  snap_put(&o, "ZX80", 4);
+  snap_put_u32(&o, SNAP_VERSION | (ZX80_BASIC_FIXED ? SNAP_FIXED : 0));
+  snap_put_u32(&o, 0); // image length, filled in at the end
+  snap_put_u32(&o, (uint32_t)vm->prog_end);
+  snap_put(&o, vm->ram, vm->prog_end);
+  size_t names_len = names_end(vm) - vm->names_base;
+  snap_put_u32(&o, (uint32_t)vm->var_count);
+  snap_put_u32(&o, (uint32_t)names_len);
+  snap_put(&o, vm->ram + vm->names_base, names_len);
+  snap_put(&o, vm->vars, (size_t)vm->var_count * sizeof(zx80_int));
+  snap_put_u32(&o, vm->rand_state);
+  // A suspended program is saved as broken into, to go on with CONT; one
+  // waiting for INPUT keeps waiting, with its target saved as slot + 1.
+  int waiting = vm->run_state == ZX80_WAITING_INPUT;
+  snap_put_ptr(&o, vm,
+               (vm->run_state == ZX80_RUNNING || waiting) ? vm->run_pc
+                                                          : vm->cont_ptr);
+  snap_put_u32(&o, waiting ? (uint32_t)vm->input_var + 1 : 0);
+  snap_put_u32(&o, (uint32_t)(waiting && vm->input_str));
+  snap_put_u32(&o, (uint32_t)vm->array_count);
+  for (int i = 0; i < vm->array_count; ++i) {
+    const zx80_array_t *arr = &vm->arrays[i];
+    snap_put_u32(&o, (uint32_t)arr->var);
+    snap_put_u32(&o, (uint32_t)arr->dims);
+    snap_put_u32(&o, arr->shift);
+    snap_put_u32(&o, (uint32_t)arr->size1);
+    snap_put_u32(&o, (uint32_t)arr->size2);
+    snap_put_u32(&o, (uint32_t)arr->offset);
+    snap_put_u32(&o, (uint32_t)arr->bytes);
+  }
+  snap_put_u32(&o, (uint32_t)vm->array_mem_used);
+  snap_put(&o, vm->array_mem, vm->array_mem_used);
+  snap_put_u32(&o, (uint32_t)vm->for_sp);
+  for (int i = 0; i < vm->for_sp; ++i) {
+    const zx80_for_frame_t *f = &vm->for_stack[i];
+    snap_put_u32(&o, (uint32_t)f->var);
+    snap_put_u32(&o, (uint32_t)f->end);
+    snap_put_u32(&o, (uint32_t)f->step);
+    snap_put_ptr(&o, vm, f->line_ptr);
+  }
+  snap_put_u32(&o, (uint32_t)vm->gosub_sp);
+  for (int i = 0; i < vm->gosub_sp; ++i) {
+    snap_put_ptr(&o, vm, vm->gosub_stack[i]);
+  }
+  snap_put_u32(&o, (uint32_t)vm->str_var_count);
+  for (int i = 0; i < vm->str_var_count; ++i) {
+    snap_put_u32(&o, (uint32_t)vm->str_vars[i].var);
+    snap_put_u32(&o, (uint32_t)vm->str_vars[i].offset);
+  }
+  snap_put_u32(&o, (uint32_t)vm->str_mem_used);
+  snap_put(&o, vm->str_mem, vm->str_mem_used);
+  snap_put_u32(&o, (uint32_t)vm->str_peak);
+  snap_put_u32(&o, vm->str_collections);
+  if (buf && o.len <= max) {
+    write_u32(buf + 8, (uint32_t)o.len);
+  }
+  return o.len;
+}
+
+int zx80_basic_restore(zx80_basic_t *vm, const uint8_t *buf, size_t len) {
+  // Check the whole image before touching the VM.
+  snap_in_t in = {buf, buf + len, 0};
+  const uint8_t *magic = snap_get(&in, 4);
+  if (!magic || memcmp(magic, "ZX80", 4) != 0 ||
+      snap_get_u32(&in) !=
+          (SNAP_VERSION | (ZX80_BASIC_FIXED ? SNAP_FIXED : 0)) ||
+      snap_get_u32(&in) != len) {
+    return -1;
+  }
+  size_t prog_end = snap_get_u32(&in);
+  const uint8_t *prog = snap_get(&in, prog_end);
+  uint32_t var_count = snap_get_u32(&in);
+  size_t names_len = snap_get_u32(&in);
+  const uint8_t *names = snap_get(&in, names_len);
+  if (var_count < VAR_LETTERS || var_count > VAR_SLOTS_MAX) {
+    return -1;
+  }
+  const uint8_t *vars = snap_get(&in, var_count * sizeof(zx80_int));
+  uint32_t rand_state = snap_get_u32(&in);
+  uint32_t cont = snap_get_u32(&in);
+  uint32_t input_var = snap_get_u32(&in);
+  uint32_t input_str = snap_get_u32(&in);
+  if (input_var > var_count || input_str > 1) {
+    return -1;
+  }
+  uint32_t array_count = snap_get_u32(&in);
+  if (array_count > ZX80_BASIC_MAX_ARRAYS) {
+    return -1;
+  }
+  zx80_array_t arrays[ZX80_BASIC_MAX_ARRAYS];
+  for (uint32_t i = 0; i < array_count; ++i) {
+    zx80_array_t *arr = &arrays[i];
+    arr->var = (int)snap_get_u32(&in);
+    arr->dims = (int)snap_get_u32(&in);
+    arr->shift = (uint8_t)snap_get_u32(&in);
+    arr->size1 = (zx80_int)snap_get_u32(&in);
+    arr->size2 = (zx80_int)snap_get_u32(&in);
+    arr->offset = snap_get_u32(&in);
+    arr->bytes = snap_get_u32(&in);
+    arr->stride = (size_t)arr->size1 + 1;
+  }
+  size_t array_used = snap_get_u32(&in);
+  const uint8_t *array_data = snap_get(&in, array_used);
+  uint32_t for_sp = snap_get_u32(&in);
+  const uint8_t *for_frames = snap_get_n(&in, for_sp, 16);
+  uint32_t gosub_sp = snap_get_u32(&in);
+  const uint8_t *gosub_frames = snap_get_n(&in, gosub_sp, 4);
+  uint32_t str_count = snap_get_u32(&in);
+  if (str_count > ZX80_BASIC_MAX_STRINGS) {
+    return -1;
+  }
+  const uint8_t *str_vars = snap_get(&in, (size_t)str_count * 8);
+  size_t str_used = snap_get_u32(&in);
+  const uint8_t *str_data = snap_get(&in, str_used);
+  size_t str_peak = snap_get_u32(&in);
+  uint32_t str_collections = snap_get_u32(&in);
+  int32_t lines = in.fail ? -1 : snap_check_program(prog, prog_end, var_count);
+  if (lines < 0 || in.p != in.end || str_used > vm->str_mem_size) {
+    return -1;
+  }
+  // Names: one length-prefixed name per slot above A to Z.
+  size_t names_at = 0;
+  for (uint32_t i = VAR_LETTERS; i < var_count; ++i) {
+    if (names_at >= names_len || names[names_at] == 0 ||
+        names[names_at] > names_len - names_at - 1) {
       return -1;
     }
-    ns = skip_ws(ns);
-    if (*ns == '\0') {
-      delete_line(vm, (uint16_t)line_num);
-      return 0;
+    names_at += 1 + (size_t)names[names_at];
+  }
+  if (names_at != names_len) {
+    return -1;
+  }
+  // The cell count is taken in 64 bits, as in exec_dim, so sizes that would
+  // wrap a 32-bit size_t cannot pass for a small block.
+  for (uint32_t i = 0; i < array_count; ++i) {
+    const zx80_array_t *arr = &arrays[i];
+    if (arr->var < 0 || (uint32_t)arr->var >= var_count || arr->dims < 1 ||
+        arr->dims > 2 || arr->shift > ARRAY_INT || arr->size1 < 0 ||
+        arr->size2 < 0 || (arr->dims == 1 && arr->size2 != 0) ||
+        arr->offset > array_used || arr->bytes > array_used - arr->offset ||
+        arr->offset % sizeof(zx80_int) != 0 ||
+        arr->bytes % sizeof(zx80_int) != 0) {
+      return -1;
     }
-    size_t len = strlen(ns);
-    if (insert_line(vm, (uint16_t)line_num, ns, len) != 0) {
-      handle_error(vm, "OUT OF MEMORY");
+    uint64_t count = ((uint64_t)arr->size1 + 1) * ((uint64_t)arr->size2 + 1);
+    if (count > (arr->bytes >> arr->shift)) {
+      return -1;
+    }
+  }
+  // Every block must lie inside the arena and a live one must be the value
+  // of the string variable it names, as str_collect relies on both.
+  uint32_t str_set = 0;
+  for (uint32_t i = 0; i < str_count; ++i) {
+    uint32_t off = read_u32(str_vars + i * 8 + 4);
+    if (read_u32(str_vars + i * 8) >= var_count ||
+        (off != (uint32_t)STR_NONE && off >= str_used)) {
+      return -1;
+    }
+    str_set += (off != (uint32_t)STR_NONE);
+  }
+  for (size_t pos = 0; pos < str_used;) {
+    uint8_t owner = (str_used - pos < 2) ? 0 : str_data[pos];
+    size_t n = (str_used - pos < 2) ? 0 : 2 + (size_t)str_data[pos + 1];
+    if (n == 0 || n > str_used - pos ||
+        (owner != STR_DEAD &&
+         (owner >= str_count ||
+          read_u32(str_vars + owner * 8 + 4) != pos))) {
+      return -1;
+    }
+    str_set -= (owner != STR_DEAD);
+    pos += n;
+  }
+  if (str_set != 0) {
+    return -1;
+  }
+  for (uint32_t i = 0; i < for_sp; ++i) {
+    if (read_u32(for_frames + i * 16) >= var_count) {
       return -1;
     }
-    return 0;
   }
 
-  uint16_t jump_line = 0xFFFF;
-  const uint8_t *jump_ptr = NULL;
-  int stop = 0;
-  int res = exec_statement(vm, s, NULL, NULL, &jump_ptr, &jump_line, &stop);
-  if (res < 0) {
-    handle_error(vm, "SYNTAX ERROR");
+  // The layout it needs in this arena.
+  size_t array_size = align_up(array_used, ARENA_ALIGN);
+  size_t for_cap = align_up(for_sp, STACK_CHUNK);
+  size_t gosub_cap = align_up(gosub_sp, STACK_CHUNK);
+  size_t low_end = arena_align(vm, prog_end) +
+                   align_up((size_t)lines, INDEX_CHUNK) * sizeof(uint16_t) +
+                   array_size +
+                   for_cap * sizeof(zx80_for_frame_t) +
+                   gosub_cap * sizeof(const uint8_t *);
+  uintptr_t top = ((uintptr_t)(vm->ram + vm->ram_size)) & ~(uintptr_t)3;
+  size_t high = var_count * sizeof(zx80_int) + names_len;
+  if ((size_t)(top - (uintptr_t)vm->ram) < high ||
+      (size_t)(top - (uintptr_t)vm->ram) - high < low_end) {
     return -1;
   }
-  if (jump_ptr) {
-    return exec_program_from(vm, (uint8_t *)jump_ptr);
+
+  zx80_basic_reset(vm);
+  memcpy(vm->ram, prog, prog_end);
+  vm->prog_end = prog_end;
+  vm->var_count = (int)var_count;
+  vm->vars = (zx80_int *)top - var_count;
+  memcpy(vm->vars, vars, var_count * sizeof(zx80_int));
+  vm->names_base = names_end(vm) - names_len;
+  memcpy(vm->ram + vm->names_base, names, names_len);
+  arena_rebase(vm, prog_end);
+  vm->gap_start = prog_end;
+  vm->gap_len = vm->index_base - prog_end;
+  vm->gap_line = GAP_LINE_UNKNOWN;
+  line_index_build(vm);
+  arena_shift(vm, REGION_FOR, (ptrdiff_t)array_size);
+  vm->array_mem_size = array_size;
+  memcpy(vm->array_mem, array_data, array_used);
+  vm->array_mem_used = array_used;
+  for (uint32_t i = 0; i < array_count; ++i) {
+    vm->arrays[i] = arrays[i];
+    vm->array_of[arrays[i].var] = (uint8_t)(i + 1);
   }
-  if (res == 1) {
-    if (jump_line != 0xFFFF) {
-      uint8_t *target = find_line(vm, jump_line, NULL);
-      if (!target) {
-        handle_error(vm, "LINE NOT FOUND");
-        return -1;
-      }
-      return exec_program_from(vm, target);
+  vm->array_count = (int)array_count;
+  for (uint32_t i = 0; i < str_count; ++i) {
+    vm->str_vars[i].var = (int)read_u32(str_vars + i * 8);
+    uint32_t off = read_u32(str_vars + i * 8 + 4);
+    vm->str_vars[i].offset = (off == (uint32_t)STR_NONE) ? STR_NONE : off;
+  }
+  vm->str_var_count = (int)str_count;
+  if (str_used) {
+    memcpy(vm->str_mem, str_data, str_used);
+  }
+  vm->str_mem_used = str_used;
+  vm->str_peak = str_peak;
+  vm->str_collections = str_collections;
+  vm->rand_state = rand_state;
+
+  // A pointer that cannot be rebuilt (a program that no longer fits the
+  // code buffer) loses the CONT point or waiting INPUT and the frames rather
+  // than the image.
+  const uint8_t *resume = NULL;
+  int ok = snap_ptr(vm, cont, &resume) == 0;
+  if (input_var) {
+    vm->run_pc = resume;
+    vm->input_var = (int)input_var - 1;
+    vm->input_str = (int)input_str;
+  } else {
+    vm->cont_ptr = resume;
+  }
+  for (uint32_t i = 0; ok && i < for_sp; ++i) {
+    const uint8_t *f = for_frames + i * 16;
+    zx80_for_frame_t *frame = for_push(vm);
+    frame->var = (int)read_u32(f);
+    frame->end = (zx80_int)read_u32(f + 4);
+    frame->step = (zx80_int)read_u32(f + 8);
+    ok = snap_ptr(vm, read_u32(f + 12), &frame->line_ptr) == 0 &&
+         frame->line_ptr;
+  }
+  for (uint32_t i = 0; ok && i < gosub_sp; ++i) {
+    const uint8_t *ret = NULL;
+    ok = snap_ptr(vm, read_u32(gosub_frames + i * 4), &ret) == 0 && ret &&
+         gosub_push(vm, ret) == 0;
+  }
+  if (!ok) {
+    vm->cont_ptr = NULL;
+    stacks_clear(vm);
+  } else if (input_var) {
+    vm->run_state = ZX80_WAITING_INPUT;
+  }
+  return 0;
+}
+
+// Crunches and runs a direct command (a line without a number).
+static int direct_command(zx80_basic_t *vm, const char *s) {
+  uint8_t buf[ZX80_BASIC_LINE_MAX];
+  size_t len = 0;
+  program_close(vm);
+  if (crunch_line(vm, s, buf, sizeof(buf), &len) != 0) {
+    handle_error(vm, "SYNTAX ERROR");
+    return -1;
+  }
+  const char *stmt = (const char *)buf;
+  while (*stmt) {
+    exec_ctx_t ctx;
+    ctx.next_stmt = NULL;
+    ctx.resume = NULL;
+    ctx.jump_ptr = NULL;
+    ctx.jump_line = 0xFFFF;
+    ctx.stop = 0;
+    ctx.skip_line = 0;
+    int res = exec_statement(vm, stmt, &ctx);
+    if (res < 0) {
+      handle_error(vm, "SYNTAX ERROR");
+      return -1;
+    }
+    if (ctx.jump_ptr) {
+      return resume_program(vm, ctx.jump_ptr);
+    }
+    if (res == 1 || ctx.jump_line != 0xFFFF) {
+      return start_program(vm, ctx.jump_line);
+    }
+    if (ctx.stop || ctx.skip_line) {
+      return 0;
     }
-    return zx80_basic_run(vm);
+    stmt = stmt_next(stmt);
   }
   return 0;
 }
+
+static int direct_line(zx80_basic_t *vm, const char *line) {
+  if (!line) {
+    return 0;
+  }
+  if (vm->run_state == ZX80_WAITING_INPUT) {
+    return input_resume(vm, line);
+  }
+  const char *s = skip_ws(line);
+  if (*s == '\0') {
+    return 0;
+  }
+  run_enter(vm);
+
+  if (isdigit((unsigned char)*s)) {
+    int res = store_line(vm, s);
+    if (res != STORE_OK) {
+      handle_error(vm, res == STORE_BAD ? "BAD LINE" : "OUT OF MEMORY");
+      return -1;
+    }
+    return 0;
+  }
+  // Names only the command used read as 0 and are forgotten after it.
+  int names = vm->var_count;
+  int res = direct_command(vm, s);
+  names_trim(vm, names);
+  return res;
+}
+
+int zx80_basic_handle_line(zx80_basic_t *vm, const char *line) {
+  int res = direct_line(vm, line);
+  out_flush(vm);
+  return res;
+}
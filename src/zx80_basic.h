@@ -8,30 +8,99 @@
 extern "C" {
 #endif
 
+// Arena for the program, variables, arrays and GOSUB/FOR stacks.
 #ifndef ZX80_BASIC_DEFAULT_RAM
-#define ZX80_BASIC_DEFAULT_RAM 1024
+#define ZX80_BASIC_DEFAULT_RAM 2048
 #endif
 
-#ifndef ZX80_BASIC_DEFAULT_ARRAY_MEM
-#define ZX80_BASIC_DEFAULT_ARRAY_MEM 1024
+#ifndef ZX80_BASIC_DEFAULT_STR_MEM
+#define ZX80_BASIC_DEFAULT_STR_MEM 512
 #endif
 
-#ifndef ZX80_BASIC_GOSUB_DEPTH
-#define ZX80_BASIC_GOSUB_DEPTH 8
+#ifndef ZX80_BASIC_FIXED
+#define ZX80_BASIC_FIXED 0
 #endif
 
-#ifndef ZX80_BASIC_FOR_DEPTH
-#define ZX80_BASIC_FOR_DEPTH 8
+#ifndef ZX80_BASIC_USE_VM
+#define ZX80_BASIC_USE_VM 1
+#endif
+
+// Threaded opcode dispatch (computed goto); needs GCC or Clang.
+#ifndef ZX80_BASIC_THREADED
+#if defined(__GNUC__)
+#define ZX80_BASIC_THREADED 1
+#else
+#define ZX80_BASIC_THREADED 0
+#endif
+#endif
+
+#ifndef ZX80_BASIC_DEFAULT_CODE
+#define ZX80_BASIC_DEFAULT_CODE 2048
+#endif
+
+#ifndef ZX80_BASIC_EVAL_DEPTH
+#define ZX80_BASIC_EVAL_DEPTH 16
+#endif
+
+#ifndef ZX80_BASIC_LINE_MAX
+#define ZX80_BASIC_LINE_MAX 256
 #endif
 
 #ifndef ZX80_BASIC_MAX_ARRAYS
 #define ZX80_BASIC_MAX_ARRAYS 8
 #endif
 
+// Native functions registered with zx80_basic_register() and the most
+// arguments one call takes (at most 8).
+#ifndef ZX80_BASIC_MAX_NATIVES
+#define ZX80_BASIC_MAX_NATIVES 8
+#endif
+
+#ifndef ZX80_BASIC_NATIVE_ARGS
+#define ZX80_BASIC_NATIVE_ARGS 4
+#endif
+
+// Page cache of a paged program (see zx80_basic_page_open): bytes per page,
+// at least ZX80_BASIC_LINE_MAX + 4, and most pages used.
+#ifndef ZX80_BASIC_PAGE_SIZE
+#define ZX80_BASIC_PAGE_SIZE 512
+#endif
+
+#ifndef ZX80_BASIC_MAX_PAGES
+#define ZX80_BASIC_MAX_PAGES 8
+#endif
+
+// FAST mode: statements (lines and FOR iterations on the bytecode engine)
+// between break checks.
+#ifndef ZX80_BASIC_FAST_POLL
+#define ZX80_BASIC_FAST_POLL 256
+#endif
+
+// Bytes of output staged before they go to write_buf or write_char.
+#ifndef ZX80_BASIC_OUT_BATCH
+#define ZX80_BASIC_OUT_BATCH 64
+#endif
+
+// Variable slots: A to Z plus interned multi-letter names.
+#define ZX80_BASIC_VAR_SLOTS 255
+
+// String variables (at most 255).
+#ifndef ZX80_BASIC_MAX_STRINGS
+#define ZX80_BASIC_MAX_STRINGS 16
+#endif
+
+// With ZX80_BASIC_FIXED=1 numbers are Q16.16 fixed point (about +-32767.9999
+// in steps of 1/65536) stored in the same 32 bits; the default is integers.
 typedef int32_t zx80_int;
 
+// Output is passed on in runs of up to ZX80_BASIC_OUT_BATCH bytes: to
+// write_buf when set (NULL to keep one write_char call per byte), at the
+// latest when the call into the interpreter returns. With read_line NULL,
+// INPUT suspends the program with run_state ZX80_WAITING_INPUT and the next
+// zx80_basic_handle_line call gives the value.
 typedef struct {
   void (*write_char)(char c, void *user);
+  void (*write_buf)(const char *buf, size_t len, void *user);
   int (*read_line)(char *buf, size_t max_len, void *user);
   int (*break_check)(void *user);
   void *user;
@@ -49,37 +118,209 @@ typedef struct {
   int dims;
   zx80_int size1;
   zx80_int size2;
+  size_t stride; // size1 + 1
+  uint8_t shift; // log2 of the cell size: 2, or 1 for WORD, 0 for BYTE
   size_t offset;
   size_t bytes;
 } zx80_array_t;
 
+typedef struct {
+  int var;
+  size_t offset;
+} zx80_str_var_t;
+
+typedef struct {
+  size_t size;        // arena bytes
+  size_t used;        // allocated, including garbage not yet collected
+  size_t live;        // held by string variables
+  size_t peak;        // highest `used` seen
+  uint32_t collections;
+} zx80_str_stats_t;
+
+// One argument of a native call: a number (raw, so Q16.16 with
+// ZX80_BASIC_FIXED), or a whole array passed as A() whose cells point into
+// array memory and are valid only during the call. Exactly one of cells,
+// words and bytes is set for an array, by its DIM type; none for a number.
+typedef struct {
+  zx80_int value;
+  zx80_int *cells;
+  int16_t *words;
+  uint8_t *bytes;
+  size_t count;
+} zx80_native_arg_t;
+
+// Returns 0 and sets *result, or non-zero to stop the program with an error.
+typedef int (*zx80_native_fn)(const zx80_native_arg_t *args, int argc,
+                              zx80_int *result, void *user);
+
+typedef struct {
+  const char *name;
+  zx80_native_fn fn;
+  void *user;
+  int slot; // variable slot of the name once seen, -1 before
+} zx80_native_t;
+
+// Reads up to len bytes of a paged program image at offset; returns the
+// number of bytes read.
+typedef struct {
+  size_t (*read)(uint32_t offset, uint8_t *buf, size_t len, void *user);
+  void *user;
+} zx80_pager_t;
+
+// Appends len bytes of a paged program image; returns 0 or -1.
+typedef int (*zx80_page_write_fn)(const uint8_t *buf, size_t len, void *user);
+
+typedef struct {
+  uint32_t start; // image offset of the first line held
+  uint32_t valid; // bytes of whole lines held, 0 if empty
+  uint32_t stamp; // last use
+} zx80_page_t;
+
+// State of the program, returned by zx80_basic_step.
+enum {
+  ZX80_STOPPED,       // not running: ended, stopped, broken into or not run
+  ZX80_RUNNING,       // suspended with its step budget spent
+  ZX80_WAITING_INPUT, // suspended until a line of input arrives
+  ZX80_ERROR          // stopped by an error
+};
+
 typedef struct {
   uint8_t *ram;
   size_t ram_size;
   size_t prog_end;
-  zx80_int vars[26];
-  const uint8_t *gosub_stack[ZX80_BASIC_GOSUB_DEPTH];
+  size_t gap_start; // line-edit gap, see program_close()
+  size_t gap_len;
+  int32_t gap_line; // line before the gap, -1 if none
+  uint16_t *line_index; // ram + index_base: offset of each line, in order
+  size_t line_count;
+  size_t line_cap;
+  zx80_int *vars;
+  int var_count;
+  size_t names_base;
+  size_t index_base; // arena offsets of the regions above the program
+  size_t array_base;
+  size_t for_base;
+  size_t gosub_base;
+  const uint8_t **gosub_stack;
   int gosub_sp;
-  zx80_for_frame_t for_stack[ZX80_BASIC_FOR_DEPTH];
+  int gosub_cap;
+  zx80_for_frame_t *for_stack;
   int for_sp;
+  int for_cap;
   const uint8_t *cont_ptr;
   uint32_t rand_state;
   zx80_array_t arrays[ZX80_BASIC_MAX_ARRAYS];
+  uint8_t array_of[ZX80_BASIC_VAR_SLOTS]; // arrays[] index + 1, 0 if none
   int array_count;
-  uint8_t *array_mem;
+  uint8_t *array_mem; // ram + array_base
   size_t array_mem_size;
   size_t array_mem_used;
+  zx80_str_var_t str_vars[ZX80_BASIC_MAX_STRINGS];
+  int str_var_count;
+  uint8_t *str_mem;
+  size_t str_mem_size;
+  size_t str_mem_used;
+  size_t str_temp;
+  int eval_skip;
+  size_t str_peak;
+  uint32_t str_collections;
+  uint8_t *code;
+  size_t code_size;
+  size_t code_end;
+  size_t code_lines;
+  int code_state;
+  uint32_t step_budget; // steps a call runs before suspending, 0 = no limit
+  uint32_t step_left;
+  int run_state;
+  const uint8_t *run_pc; // where a suspended program goes on
+  int input_var;         // slot the waiting INPUT assigns
+  int input_str;         // nonzero when it is a string variable
+  int fast;              // FAST mode, see zx80_basic_set_fast
+  uint32_t poll_left;    // statements to the next break check
+  volatile int poll_now; // set (e.g. from a timer) to check at once
+  size_t out_len;
+  char out_buf[ZX80_BASIC_OUT_BATCH];
+  zx80_pager_t pager; // set while a paged program is open
+  uint8_t *page_mem;
+  int page_count;
+  zx80_page_t pages[ZX80_BASIC_MAX_PAGES];
+  uint32_t page_clock;
+  uint32_t page_lines; // line count, then where the lines and index start
+  uint32_t page_first;
+  uint32_t page_index;
+  const char *page_pc; // statement running, its page stays cached
+  int page_error;
+  zx80_native_t natives[ZX80_BASIC_MAX_NATIVES];
+  int native_count;
   zx80_io_t io;
 } zx80_basic_t;
 
+// Sets the VM up on buffers of the caller, which must outlive it. ram is the
+// arena of the program, variables, arrays and GOSUB/FOR stacks. Strings and
+// bytecode have fixed needs that the arena layout cannot move around, so
+// they get buffers of their own: str_mem holds the string variables (NULL:
+// none can be used) and code the compiled program (NULL, or any build with
+// ZX80_BASIC_USE_VM=0: programs run on the reference interpreter).
 void zx80_basic_init(zx80_basic_t *vm, uint8_t *ram, size_t ram_size,
-                     zx80_io_t io);
+                     uint8_t *str_mem, size_t str_mem_size, uint8_t *code,
+                     size_t code_size, zx80_io_t io);
+// zx80_basic_init on static buffers of the ZX80_BASIC_DEFAULT_* sizes.
 void zx80_basic_init_default(zx80_basic_t *vm, zx80_io_t io);
 void zx80_basic_reset(zx80_basic_t *vm);
+// Makes fn callable from BASIC as USR NAME(args), in expressions or as a
+// statement. Call after zx80_basic_init; name must stay valid. Returns -1
+// when the table is full.
+int zx80_basic_register(zx80_basic_t *vm, const char *name, zx80_native_fn fn,
+                        void *user);
 
 int zx80_basic_handle_line(zx80_basic_t *vm, const char *line);
+// Replaces the program (and, like NEW, the variables) with the numbered
+// lines of a listing in buf, which need not be NUL terminated. Lines in
+// order are appended in one pass; others are inserted where they belong.
+// Each rejected line is reported with its position in buf. Returns the
+// number of rejected lines, or -1 if memory ran out.
+int zx80_basic_load_buffer(zx80_basic_t *vm, const char *buf, size_t len);
+// Crunches the listing in buf (lines in ascending order) into a paged
+// program image passed to write, for programs too big for the arena.
+// Resets the VM. Returns the number of rejected lines, or -1 if memory ran
+// out or write failed.
+int zx80_basic_page_build(zx80_basic_t *vm, const char *buf, size_t len,
+                          zx80_page_write_fn write, void *user);
+// Replaces the program with the image behind pager (like NEW otherwise).
+// Lines are read into the cache buffer (at least two ZX80_BASIC_PAGE_SIZE
+// pages) as they run; the image must stay readable until the next NEW,
+// LOAD or program edit closes it. Returns -1 if the image is not valid.
+int zx80_basic_page_open(zx80_basic_t *vm, zx80_pager_t pager, uint8_t *cache,
+                         size_t cache_size);
 int zx80_basic_run(zx80_basic_t *vm);
+// With step_budget set, zx80_basic_run and a RUN, GOTO or CONT given to
+// zx80_basic_handle_line return after that many steps (statements on the
+// reference engine, lines and FOR iterations on the bytecode one) with
+// run_state ZX80_RUNNING. zx80_basic_step then runs the program for up to
+// budget more steps (0 = to the end) and returns the new state. Calling
+// zx80_basic_handle_line or zx80_basic_run instead breaks into a suspended
+// program, so CONT goes on with it. In state ZX80_WAITING_INPUT the next
+// line given to zx80_basic_handle_line is the INPUT value instead, and the
+// program goes on from the same statement.
+int zx80_basic_step(zx80_basic_t *vm, uint32_t budget);
+// Like the FAST and SLOW statements: FAST calls break_check only every
+// ZX80_BASIC_FAST_POLL statements or when poll_now is set, and passes output
+// on when the buffer fills or the call returns; SLOW (the default, restored
+// by NEW) checks and passes on the output of every statement. The step
+// budget applies in both modes.
+void zx80_basic_set_fast(zx80_basic_t *vm, int fast);
+// Writes the program, variables, arrays, strings, GOSUB/FOR frames and CONT
+// point (or the INPUT the program waits for) as a versioned image that does
+// not depend on buffer addresses. Like snprintf, returns the image size and
+// writes only if it fits in max (buf may be NULL to ask for the size).
+// Returns 0 for a paged program, which cannot be saved.
+size_t zx80_basic_snapshot(zx80_basic_t *vm, uint8_t *buf, size_t max);
+// Replaces the state with an image from zx80_basic_snapshot, keeping io, the
+// natives and the buffers. Returns -1, leaving the VM untouched, when the
+// image is damaged, from another version or build, or does not fit.
+int zx80_basic_restore(zx80_basic_t *vm, const uint8_t *buf, size_t len);
 void zx80_basic_list(zx80_basic_t *vm);
+void zx80_basic_string_stats(const zx80_basic_t *vm, zx80_str_stats_t *out);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,16 @@
+10 DIM A(5)
+20 DIM B(100)
+30 LET A(5)=1: LET B(100)=2
+40 DIM A(200)
+50 PRINT A(5); " "; B(100); " "; A(200)
+60 LET A(200)=3
+70 DIM B(1)
+80 DIM C(150)
+90 LET C(150)=4
+100 PRINT A(200); " "; B(1); " "; C(150)
+110 DIM A(2,3)
+120 LET A(2,3)=5: PRINT A(2,3); " "; C(150)
+130 PRINT A(3,3)
+RUN
+DIM Z(1000)
+PRINT C(150)
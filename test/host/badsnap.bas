@@ -0,0 +1,7 @@
+NEW
+REM WORDS 152 AND 156 OF AN EMPTY IMAGE ARE FOR_SP AND GOSUB_SP
+#patch 152 0
+#patch 152 268435457
+#patch 152 2147483648
+#patch 156 1073741825
+PRINT "SAME VM"
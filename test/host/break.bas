@@ -0,0 +1,19 @@
+10 FOR I=1 TO 2: LET I=1: NEXT I
+#break 100
+RUN
+PRINT "OUT"
+NEW
+10 FOR I=1 TO 3000: NEXT I
+20 PRINT I
+#break 50
+RUN
+CONT
+NEW
+10 GOTO 10
+#break 20
+RUN
+#fast
+10 FOR I=1 TO 2: LET I=1: NEXT I
+#break 3
+RUN
+PRINT "OUT"
@@ -0,0 +1,20 @@
+10 DIM A(9)
+20 DIM B(2,2)
+30 FILL A, 3
+40 PRINT SUM(A)
+50 FOR I=0 TO 9: LET A(I)=(I*7)-(I*7)/10*10: NEXT I
+60 SORT A
+70 FOR I=0 TO 9: PRINT A(I);: NEXT I
+80 PRINT
+90 COPY A TO B
+100 PRINT SUM(B); " "; B(0,0); " "; B(2,2)
+110 FILL B
+120 PRINT SUM(B)
+130 DIM C(2)
+140 LET C(0)=-5: LET C(1)=10: LET C(2)=-20
+150 SORT C: PRINT C(0); " "; C(1); " "; C(2); " "; SUM(C)
+160 COPY C TO A
+170 PRINT A(0); " "; A(3); " "; SUM(A)
+RUN
+FILL Z
+SORT Q
@@ -0,0 +1,239 @@
+// Host driver for run.sh: feeds a script to the interpreter and prints what
+// it writes, so the bytecode and reference builds can be compared.
+//
+// Script lines go to zx80_basic_handle_line (INPUT takes the next line, as
+// read_line is NULL); a suspended program is stepped to its end. Lines
+// starting with # are directives:
+//   #break N   break_check returns 1 on its Nth call from here
+//   #step N    step budget of RUN, GOTO and CONT, and of each step after
+//   #fast      FAST mode
+//   #snap      snapshot, restore into a second VM and go on with that one
+//              (or, if there is no snapshot, with the same VM)
+//   #patch N V snapshot, set the little-endian word at byte N of the image
+//              to V, restore it into a second VM and print RESTORE and the
+//              result; the same VM goes on
+//   #page      the lines up to #end are built into a paged image and opened
+//   #load      the lines up to #end are loaded as a listing
+// The natives USR ADD (sums numbers and arrays), USR TICK (counts its calls
+// into the first cell of an array argument) and USR FAIL are registered.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "zx80_basic.h"
+
+#define SCRIPT_LINE 512
+#define IMAGE_MAX 16384
+
+typedef struct {
+  zx80_basic_t vm;
+  uint8_t ram[ZX80_BASIC_DEFAULT_RAM];
+  uint8_t str[ZX80_BASIC_DEFAULT_STR_MEM];
+  uint8_t code[ZX80_BASIC_DEFAULT_CODE];
+} machine_t;
+
+static machine_t machines[2];
+static uint8_t page_cache[2 * ZX80_BASIC_PAGE_SIZE];
+static uint8_t image[IMAGE_MAX];
+static size_t image_len;
+static long break_at;
+
+static void write_char(char c, void *user) {
+  (void)user;
+  putchar(c);
+}
+
+static void write_buf(const char *buf, size_t len, void *user) {
+  (void)user;
+  fwrite(buf, 1, len, stdout);
+}
+
+static int break_check(void *user) {
+  (void)user;
+  return break_at > 0 && --break_at == 0;
+}
+
+static int image_write(const uint8_t *buf, size_t len, void *user) {
+  (void)user;
+  if (len > IMAGE_MAX - image_len) {
+    return -1;
+  }
+  memcpy(image + image_len, buf, len);
+  image_len += len;
+  return 0;
+}
+
+static size_t image_read(uint32_t offset, uint8_t *buf, size_t len,
+                         void *user) {
+  (void)user;
+  if (offset >= image_len) {
+    return 0;
+  }
+  if (len > image_len - offset) {
+    len = image_len - offset;
+  }
+  memcpy(buf, image + offset, len);
+  return len;
+}
+
+static int native_add(const zx80_native_arg_t *args, int argc,
+                      zx80_int *result, void *user) {
+  (void)user;
+  zx80_int sum = 0;
+  for (int i = 0; i < argc; ++i) {
+    if (!args[i].cells && !args[i].words && !args[i].bytes) {
+      sum += args[i].value;
+    }
+    for (size_t k = 0; k < args[i].count; ++k) {
+      sum += args[i].cells   ? args[i].cells[k]
+             : args[i].words ? args[i].words[k]
+                             : args[i].bytes[k];
+    }
+  }
+  *result = sum;
+  return 0;
+}
+
+static int native_tick(const zx80_native_arg_t *args, int argc,
+                       zx80_int *result, void *user) {
+  int *ticks = (int *)user;
+  *result = ++*ticks;
+  if (argc > 0 && args[0].cells && args[0].count > 0) {
+    args[0].cells[0] = *ticks;
+  }
+  return 0;
+}
+
+static int native_fail(const zx80_native_arg_t *args, int argc,
+                       zx80_int *result, void *user) {
+  (void)args;
+  (void)argc;
+  (void)result;
+  (void)user;
+  return 1;
+}
+
+static zx80_basic_t *machine_init(machine_t *m) {
+  static int ticks;
+  zx80_io_t io = {0};
+  io.write_char = write_char;
+  io.write_buf = write_buf;
+  io.break_check = break_check;
+  zx80_basic_init(&m->vm, m->ram, sizeof(m->ram), m->str, sizeof(m->str),
+                  m->code, sizeof(m->code), io);
+  zx80_basic_register(&m->vm, "ADD", native_add, NULL);
+  zx80_basic_register(&m->vm, "TICK", native_tick, &ticks);
+  zx80_basic_register(&m->vm, "FAIL", native_fail, NULL);
+  zx80_basic_reset(&m->vm);
+  return &m->vm;
+}
+
+static void finish(zx80_basic_t *vm) {
+  while (vm->run_state == ZX80_RUNNING) {
+    zx80_basic_step(vm, vm->step_budget);
+  }
+}
+
+// Reads the script lines up to #end into listing; returns their length.
+static size_t listing_in(FILE *f, char *listing, size_t max) {
+  size_t len = 0;
+  char line[SCRIPT_LINE];
+  while (fgets(line, sizeof(line), f) && strncmp(line, "#end", 4) != 0) {
+    size_t n = strlen(line);
+    if (n < max - len) {
+      memcpy(listing + len, line, n);
+      len += n;
+    }
+  }
+  return len;
+}
+
+// Builds the listing up to #end into the image and opens it.
+static void page_in(zx80_basic_t *vm, FILE *f) {
+  static char listing[IMAGE_MAX];
+  size_t len = listing_in(f, listing, sizeof(listing));
+  image_len = 0;
+  int bad = zx80_basic_page_build(vm, listing, len, image_write, NULL);
+  zx80_pager_t pager = {image_read, NULL};
+  if (bad != 0 ||
+      zx80_basic_page_open(vm, pager, page_cache, sizeof(page_cache)) != 0) {
+    printf("PAGE FAILED %d\n", bad);
+  }
+}
+
+// Moves the state of machine `from` into the other one.
+static zx80_basic_t *snap_swap(int *from) {
+  static uint8_t buf[IMAGE_MAX];
+  zx80_basic_t *a = &machines[*from].vm;
+  size_t len = zx80_basic_snapshot(a, buf, sizeof(buf));
+  if (len == 0 || len > sizeof(buf)) {
+    printf("SNAP FAILED\n");
+    return a;
+  }
+  *from = !*from;
+  zx80_basic_t *b = machine_init(&machines[*from]);
+  b->step_budget = a->step_budget;
+  if (zx80_basic_restore(b, buf, len) != 0) {
+    printf("SNAP FAILED\n");
+  }
+  return b;
+}
+
+// Restores a snapshot of vm with one word changed into the other machine.
+static void snap_patch(zx80_basic_t *vm, int cur, const char *args) {
+  static uint8_t buf[IMAGE_MAX];
+  char *end;
+  unsigned long at = strtoul(args, &end, 0);
+  uint32_t v = (uint32_t)strtoul(end, NULL, 0);
+  size_t len = zx80_basic_snapshot(vm, buf, sizeof(buf));
+  if (len == 0 || len > sizeof(buf) || at > len - 4) {
+    printf("SNAP FAILED\n");
+    return;
+  }
+  for (int i = 0; i < 4; ++i) {
+    buf[at + i] = (uint8_t)(v >> (8 * i));
+  }
+  zx80_basic_t *b = machine_init(&machines[!cur]);
+  printf("RESTORE %d\n", zx80_basic_restore(b, buf, len));
+}
+
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s script\n", argv[0]);
+    return 2;
+  }
+  FILE *f = fopen(argv[1], "r");
+  if (!f) {
+    perror(argv[1]);
+    return 2;
+  }
+  int cur = 0;
+  zx80_basic_t *vm = machine_init(&machines[cur]);
+  char line[SCRIPT_LINE];
+  while (fgets(line, sizeof(line), f)) {
+    line[strcspn(line, "\r\n")] = '\0';
+    if (strncmp(line, "#break ", 7) == 0) {
+      break_at = atol(line + 7);
+    } else if (strncmp(line, "#step ", 6) == 0) {
+      vm->step_budget = (uint32_t)atol(line + 6);
+    } else if (strcmp(line, "#fast") == 0) {
+      zx80_basic_set_fast(vm, 1);
+    } else if (strcmp(line, "#snap") == 0) {
+      vm = snap_swap(&cur);
+    } else if (strncmp(line, "#patch ", 7) == 0) {
+      snap_patch(vm, cur, line + 7);
+    } else if (strcmp(line, "#page") == 0) {
+      page_in(vm, f);
+    } else if (strcmp(line, "#load") == 0) {
+      static char listing[IMAGE_MAX];
+      size_t len = listing_in(f, listing, sizeof(listing));
+      printf("LOAD %d\n", zx80_basic_load_buffer(vm, listing, len));
+    } else {
+      zx80_basic_handle_line(vm, line);
+      finish(vm);
+    }
+  }
+  fclose(f);
+  return 0;
+}
@@ -0,0 +1,27 @@
+50 PRINT "FIFTY"
+10 PRINT "TEN"
+30 PRINT "THIRTY"
+20 PRINT "TWENTY"
+40 PRINT "FORTY"
+LIST
+RUN
+30 PRINT "NEW THIRTY": PRINT "MORE TEXT ON THIRTY"
+30 PRINT "SHORT 30"
+25 PRINT "TWENTY-FIVE"
+10
+60
+5 PRINT "FIVE"
+55 PRINT "FIFTY-FIVE"
+50
+LIST
+RUN
+1 REM A
+2 REM B
+3 REM C
+2
+1
+45 GOSUB 1000
+1000 PRINT "SUB": RETURN
+3
+LIST
+RUN
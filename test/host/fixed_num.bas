@@ -0,0 +1,13 @@
+10 LET A=1.5
+20 LET B=.25
+30 PRINT A*B; " "; A/B; " "; 1/3; " "; 2/3; " "; -7/2
+40 PRINT 0.0001; " "; 100.1; " "; -0.5; " "; 3.0
+50 FOR X=0 TO 1 STEP .25: PRINT X; " ";: NEXT X
+60 PRINT
+70 PRINT -32768; " "; -(-32768); " "; 32767.9999
+80 IF 1.5>1.25 AND .1<.2 THEN PRINT "CMP"
+90 LET C=2: FOR I=1 TO 4: LET C=C/2: NEXT I: PRINT C
+RUN
+INPUT D
+2.75
+PRINT D*2
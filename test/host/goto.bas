@@ -0,0 +1,48 @@
+10 FOR I=1 TO 40
+20 GOSUB 1000+(I-I/7*7)*10-5*(I>20)
+30 NEXT I
+40 PRINT S
+50 END
+1000 S=S+1: RETURN
+1005 S=S-1: RETURN
+1010 S=S+2: RETURN
+1015 S=S-2: RETURN
+1020 S=S+3: RETURN
+1025 S=S-3: RETURN
+1030 S=S+4: RETURN
+1035 S=S-4: RETURN
+1040 S=S+5: RETURN
+1045 S=S-5: RETURN
+1050 S=S+6: RETURN
+1055 S=S-6: RETURN
+1060 S=S+7: RETURN
+1065 S=S-7: RETURN
+RUN
+1003 S=S+100: RETURN
+1003
+1000
+S=0
+RUN
+1000 S=S+1000: RETURN
+S=0
+GOTO 10
+LET N=1060
+GOTO N
+PRINT S
+GOTO N+1
+NEW
+90 PRINT "T=";T
+80 LET T=T+1: GOTO (T+1)*10
+70 LET T=T+1: GOTO (T+1)*10
+60 LET T=T+1: GOTO (T+1)*10
+50 LET T=T+1: GOTO (T+1)*10
+40 LET T=T+1: GOTO (T+1)*10
+30 LET T=T+1: GOTO (T+1)*10
+20 LET T=T+1: GOTO (T+1)*10
+10 LET T=1: GOTO (T+1)*10
+RUN
+50
+RUN
+50 LET T=T+1: GOTO (T+1)*10
+35 REM
+RUN
@@ -0,0 +1,13 @@
+10 FOR I=1 TO 10 STEP 3: LET S=S+I: NEXT I
+20 FOR J=10 TO 1 STEP -4: LET S=S+J: NEXT J
+30 LET K=5: LET K=K+7: LET K=K-2
+40 IF K=10 THEN 60
+50 PRINT "NO"
+60 IF K<>10 THEN PRINT "NO"
+70 IF K>9 THEN PRINT "GT"
+80 IF K<=10 THEN IF K>=10 THEN PRINT "LE GE"
+90 FOR N=1 TO 0: PRINT "NEVER": NEXT N
+100 PRINT S; " "; K; " "; I; " "; J; " "; N
+110 FOR X=1 TO 3: FOR Y=X TO 3: LET P=P+1: NEXT Y: NEXT X
+120 PRINT P
+RUN
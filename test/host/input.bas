@@ -0,0 +1,46 @@
+10 INPUT A
+20 INPUT N$
+30 FOR I=1 TO 2: INPUT B: LET S=S+B: NEXT I
+40 PRINT N$; " "; A+S
+50 GOSUB 100
+60 PRINT "DONE "; C
+70 END
+100 INPUT C: IF C<0 THEN PRINT "NEG"
+110 RETURN
+RUN
+7
+ZED
+1
+2
+-4
+#step 2
+RUN
+1
+TWO WORDS
+3
+4
+5
+PRINT "DIRECT"
+INPUT X
+8
+PRINT X
+RUN
+9
+LIST 10
+3
+2*X
+-1
+#step 0
+RUN
+11
+#snap
+SNAPPED
+1
+#snap
+2
+#snap
+6
+INPUT Y
+#snap
+4
+PRINT Y
@@ -0,0 +1,15 @@
+10 IF 0 THEN GOTO 99
+20 PRINT "REACHED"
+30 IF 0 THEN GOSUB 98
+40 PRINT "AGAIN"
+RUN
+50 GOSUB 97
+RUN
+50 RUN 96
+RUN
+50 GOTO 95
+RUN
+50 IF 1 THEN 94
+RUN
+PRINT "DIRECT"
+GOTO 93
@@ -0,0 +1,19 @@
+10 PRINT "OLD"
+LET Q=5
+#load
+10 PRINT "LOADED"; Q
+30 GOSUB 100
+
+20 LET X=X+1
+this is not a line
+100 PRINT "SUB"; X: RETURN
+40 PRINT "END"
+99999 PRINT "BIG"
+#end
+RUN
+LIST
+#load
+10 PRINT 1
+20 PRINT 2
+#end
+RUN
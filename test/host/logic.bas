@@ -0,0 +1,13 @@
+10 DIM A(3)
+20 LET A(1)=5
+30 PRINT 1 AND 0; " "; 1 OR 0; " "; NOT 0; " "; NOT -1; " "; 6 AND 3; " "; 6 OR 3
+40 PRINT 1<2 AND 2<3; " "; 1>2 OR 2>3; " "; NOT 1=2
+50 PRINT 1<2<3; " "; 2+3*4; " "; (2+3)*4; " "; -2*-3
+60 LET I=5
+70 IF I>9 AND A(I)=0 THEN PRINT "NO"
+80 PRINT "SKIPPED A(5)"
+90 IF I>9 OR A(1)=5 THEN PRINT "OR RIGHT"
+100 IF I=5 OR A(I)=0 THEN PRINT "OR SKIPPED A(5)"
+110 IF 0 AND USR FAIL(1) THEN PRINT "NO"
+120 PRINT NOT 1 OR 2 AND 3
+RUN
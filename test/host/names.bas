@@ -0,0 +1,65 @@
+10 LET SCORE=10
+20 LET HI1=SCORE*2
+30 LET SCORE2=HI1+SCORE
+40 FOR COUNT=1 TO 3: LET TOTAL=TOTAL+COUNT*SCORE: NEXT COUNT
+50 PRINT SCORE; " "; HI1; " "; SCORE2; " "; TOTAL; " "; COUNT
+60 DIM GRID(2,2)
+70 LET GRID(2,2)=SCORE2
+80 PRINT GRID(2,2)
+90 LET A=1: LET AB=2: LET ABC=3: PRINT A+AB+ABC
+RUN
+PRINT SCORE+TOTAL
+LIST 10
+NEW
+PRINT SCORE
+LET NEWNAME=7: PRINT NEWNAME
+IF Q0N0+Q0N1+Q0N2+Q0N3+Q0N4+Q0N5+Q0N6+Q0N7+Q0N8+Q0N9 THEN PRINT "SET"
+IF Q1N0+Q1N1+Q1N2+Q1N3+Q1N4+Q1N5+Q1N6+Q1N7+Q1N8+Q1N9 THEN PRINT "SET"
+IF Q2N0+Q2N1+Q2N2+Q2N3+Q2N4+Q2N5+Q2N6+Q2N7+Q2N8+Q2N9 THEN PRINT "SET"
+IF Q3N0+Q3N1+Q3N2+Q3N3+Q3N4+Q3N5+Q3N6+Q3N7+Q3N8+Q3N9 THEN PRINT "SET"
+IF Q4N0+Q4N1+Q4N2+Q4N3+Q4N4+Q4N5+Q4N6+Q4N7+Q4N8+Q4N9 THEN PRINT "SET"
+IF Q5N0+Q5N1+Q5N2+Q5N3+Q5N4+Q5N5+Q5N6+Q5N7+Q5N8+Q5N9 THEN PRINT "SET"
+IF Q6N0+Q6N1+Q6N2+Q6N3+Q6N4+Q6N5+Q6N6+Q6N7+Q6N8+Q6N9 THEN PRINT "SET"
+IF Q7N0+Q7N1+Q7N2+Q7N3+Q7N4+Q7N5+Q7N6+Q7N7+Q7N8+Q7N9 THEN PRINT "SET"
+IF Q8N0+Q8N1+Q8N2+Q8N3+Q8N4+Q8N5+Q8N6+Q8N7+Q8N8+Q8N9 THEN PRINT "SET"
+IF Q9N0+Q9N1+Q9N2+Q9N3+Q9N4+Q9N5+Q9N6+Q9N7+Q9N8+Q9N9 THEN PRINT "SET"
+IF Q10N0+Q10N1+Q10N2+Q10N3+Q10N4+Q10N5+Q10N6+Q10N7+Q10N8+Q10N9 THEN PRINT "SET"
+IF Q11N0+Q11N1+Q11N2+Q11N3+Q11N4+Q11N5+Q11N6+Q11N7+Q11N8+Q11N9 THEN PRINT "SET"
+IF Q12N0+Q12N1+Q12N2+Q12N3+Q12N4+Q12N5+Q12N6+Q12N7+Q12N8+Q12N9 THEN PRINT "SET"
+IF Q13N0+Q13N1+Q13N2+Q13N3+Q13N4+Q13N5+Q13N6+Q13N7+Q13N8+Q13N9 THEN PRINT "SET"
+IF Q14N0+Q14N1+Q14N2+Q14N3+Q14N4+Q14N5+Q14N6+Q14N7+Q14N8+Q14N9 THEN PRINT "SET"
+IF Q15N0+Q15N1+Q15N2+Q15N3+Q15N4+Q15N5+Q15N6+Q15N7+Q15N8+Q15N9 THEN PRINT "SET"
+IF Q16N0+Q16N1+Q16N2+Q16N3+Q16N4+Q16N5+Q16N6+Q16N7+Q16N8+Q16N9 THEN PRINT "SET"
+IF Q17N0+Q17N1+Q17N2+Q17N3+Q17N4+Q17N5+Q17N6+Q17N7+Q17N8+Q17N9 THEN PRINT "SET"
+IF Q18N0+Q18N1+Q18N2+Q18N3+Q18N4+Q18N5+Q18N6+Q18N7+Q18N8+Q18N9 THEN PRINT "SET"
+IF Q19N0+Q19N1+Q19N2+Q19N3+Q19N4+Q19N5+Q19N6+Q19N7+Q19N8+Q19N9 THEN PRINT "SET"
+IF Q20N0+Q20N1+Q20N2+Q20N3+Q20N4+Q20N5+Q20N6+Q20N7+Q20N8+Q20N9 THEN PRINT "SET"
+IF Q21N0+Q21N1+Q21N2+Q21N3+Q21N4+Q21N5+Q21N6+Q21N7+Q21N8+Q21N9 THEN PRINT "SET"
+IF Q22N0+Q22N1+Q22N2+Q22N3+Q22N4+Q22N5+Q22N6+Q22N7+Q22N8+Q22N9 THEN PRINT "SET"
+30 LET X=R0N0+R0N1+R0N2+R0N3+R0N4+R0N5+R0N6+R0N7+R0N8+R0N9: REM ZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZ
+30 LET X=R1N0+R1N1+R1N2+R1N3+R1N4+R1N5+R1N6+R1N7+R1N8+R1N9: REM ZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZ
+30 LET X=R2N0+R2N1+R2N2+R2N3+R2N4+R2N5+R2N6+R2N7+R2N8+R2N9: REM ZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZ
+30 LET X=R3N0+R3N1+R3N2+R3N3+R3N4+R3N5+R3N6+R3N7+R3N8+R3N9: REM ZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZ
+30 LET X=R4N0+R4N1+R4N2+R4N3+R4N4+R4N5+R4N6+R4N7+R4N8+R4N9: REM ZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZ
+30 LET X=R5N0+R5N1+R5N2+R5N3+R5N4+R5N5+R5N6+R5N7+R5N8+R5N9: REM ZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZ
+30 LET X=R6N0+R6N1+R6N2+R6N3+R6N4+R6N5+R6N6+R6N7+R6N8+R6N9: REM ZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZ
+30 LET X=R7N0+R7N1+R7N2+R7N3+R7N4+R7N5+R7N6+R7N7+R7N8+R7N9: REM ZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZ
+30 LET X=R8N0+R8N1+R8N2+R8N3+R8N4+R8N5+R8N6+R8N7+R8N8+R8N9: REM ZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZ
+30 LET X=R9N0+R9N1+R9N2+R9N3+R9N4+R9N5+R9N6+R9N7+R9N8+R9N9: REM ZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZ
+30 LET X=R10N0+R10N1+R10N2+R10N3+R10N4+R10N5+R10N6+R10N7+R10N8+R10N9: REM ZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZ
+30 LET X=R11N0+R11N1+R11N2+R11N3+R11N4+R11N5+R11N6+R11N7+R11N8+R11N9: REM ZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZ
+30 LET X=R12N0+R12N1+R12N2+R12N3+R12N4+R12N5+R12N6+R12N7+R12N8+R12N9: REM ZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZ
+30 LET X=R13N0+R13N1+R13N2+R13N3+R13N4+R13N5+R13N6+R13N7+R13N8+R13N9: REM ZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZ
+30 LET X=R14N0+R14N1+R14N2+R14N3+R14N4+R14N5+R14N6+R14N7+R14N8+R14N9: REM ZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZ
+30 LET X=R15N0+R15N1+R15N2+R15N3+R15N4+R15N5+R15N6+R15N7+R15N8+R15N9: REM ZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZ
+30 LET X=R16N0+R16N1+R16N2+R16N3+R16N4+R16N5+R16N6+R16N7+R16N8+R16N9: REM ZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZ
+30 LET X=R17N0+R17N1+R17N2+R17N3+R17N4+R17N5+R17N6+R17N7+R17N8+R17N9: REM ZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZ
+30 LET X=R18N0+R18N1+R18N2+R18N3+R18N4+R18N5+R18N6+R18N7+R18N8+R18N9: REM ZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZ
+30 LET X=R19N0+R19N1+R19N2+R19N3+R19N4+R19N5+R19N6+R19N7+R19N8+R19N9: REM ZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZ
+30 LET X=R20N0+R20N1+R20N2+R20N3+R20N4+R20N5+R20N6+R20N7+R20N8+R20N9: REM ZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZ
+30 LET X=R21N0+R21N1+R21N2+R21N3+R21N4+R21N5+R21N6+R21N7+R21N8+R21N9: REM ZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZ
+30 LET X=R22N0+R22N1+R22N2+R22N3+R22N4+R22N5+R22N6+R22N7+R22N8+R22N9: REM ZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZ
+20 LET ZZ=1: LET KEEP=KEEP+ZZ
+RUN
+PRINT ZZ;" ";KEEP;" ";NEWNAME
+LIST
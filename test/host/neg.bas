@@ -0,0 +1,6 @@
+10 LET A=-2147483648
+20 PRINT A; " "; -A; " "; -(-A)
+30 PRINT -2147483647-1; " "; 2147483647
+40 PRINT -0; " "; -5; " "; -(3-8)
+RUN
+PRINT -2147483648
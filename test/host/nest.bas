@@ -0,0 +1,44 @@
+10 FOR V0=1 TO 2
+11 FOR V1=1 TO 2
+12 FOR V2=1 TO 2
+13 FOR V3=1 TO 2
+14 FOR V4=1 TO 2
+15 FOR V5=1 TO 2
+16 FOR V6=1 TO 2
+17 FOR V7=1 TO 2
+18 FOR V8=1 TO 2
+19 FOR V9=1 TO 2
+20 FOR V10=1 TO 2
+21 FOR V11=1 TO 2
+22 FOR V12=1 TO 2
+23 FOR V13=1 TO 2
+24 FOR V14=1 TO 2
+25 FOR V15=1 TO 2
+26 FOR V16=1 TO 2
+27 FOR V17=1 TO 2
+28 FOR V18=1 TO 2
+29 FOR V19=1 TO 2
+30 C=C+1
+101 NEXT V19
+102 NEXT V18
+103 NEXT V17
+104 NEXT V16
+105 NEXT V15
+106 NEXT V14
+107 NEXT V13
+108 NEXT V12
+109 NEXT V11
+110 NEXT V10
+111 NEXT V9
+112 NEXT V8
+113 NEXT V7
+114 NEXT V6
+115 NEXT V5
+116 NEXT V4
+117 NEXT V3
+118 NEXT V2
+119 NEXT V1
+120 NEXT V0
+200 PRINT C
+210 FOR Z=1 TO 0: PRINT "NO": NEXT Z: PRINT "ZERO"
+RUN
@@ -0,0 +1,10 @@
+10 FOR I=1 TO 30: PRINT "0123456789";: NEXT I
+20 PRINT
+30 PRINT 2147483647; " "; -2147483647; " "; 0; " "; 100; " "; -99
+40 FOR I=1 TO 200: PRINT I;: NEXT I
+50 PRINT
+60 PRINT ;
+70 PRINT "A";: PRINT "B": PRINT "C"
+RUN
+#step 1
+RUN
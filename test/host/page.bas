@@ -0,0 +1,24 @@
+#page
+10 PRINT "PAGED"
+20 FOR I=1 TO 6
+25 LET K=K+1: IF K=3 THEN LET K=0
+30 GOSUB 1000+K*100
+40 NEXT I
+50 PRINT S
+60 IF S>10 THEN STOP
+70 PRINT "DONE"
+80 END
+1000 S=S+1: RETURN
+1100 S=S+2: RETURN
+1200 S=S+3: PRINT I;: RETURN
+#end
+RUN
+CONT
+#step 3
+RUN
+CONT
+#step 0
+RUN
+#snap
+CONT
+LIST
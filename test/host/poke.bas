@@ -0,0 +1,9 @@
+10 DIM BYTE A(4)
+20 FOR I=0 TO 2047
+30 POKE I,PEEK(I)+1
+40 NEXT I
+50 PRINT A(0);A(1);A(2)
+60 POKE 0,7
+70 PRINT "OK"
+RUN
+LIST 10
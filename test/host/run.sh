@@ -0,0 +1,47 @@
+#!/bin/sh
+# Builds check.c against the bytecode (ZX80_BASIC_USE_VM=1) and reference
+# (=0) interpreters with the host compiler, runs every *.bas script here
+# through both and checks that each prints the same as the other and as its
+# .out file, giving each run 10 seconds where timeout(1) exists. Scripts
+# named fixed_*.bas run on ZX80_BASIC_FIXED=1 builds, the others on integer
+# ones. Extra arguments go to the compiler. Usage: test/host/run.sh [cflags],
+# e.g. test/host/run.sh -DZX80_BASIC_THREADED=0
+
+dir=$(cd "$(dirname "$0")" && pwd)
+src="$dir/../../src"
+tmp=$(mktemp -d) || exit 1
+trap 'rm -rf "$tmp"' EXIT
+cc=${CC:-cc}
+limit=
+command -v timeout > /dev/null && limit="timeout 10"
+
+for fixed in 0 1; do
+  for vm in 1 0; do
+    $cc -std=c99 -O2 -Wall -Wextra -Werror -DZX80_BASIC_USE_VM=$vm \
+      -DZX80_BASIC_FIXED=$fixed "$@" -I"$src" "$src/zx80_basic.c" \
+      "$dir/check.c" -o "$tmp/check$fixed$vm" || exit 1
+  done
+done
+
+fail=0
+for script in "$dir"/*.bas; do
+  name=$(basename "$script" .bas)
+  case $name in
+    fixed_*) fixed=1 ;;
+    *) fixed=0 ;;
+  esac
+  $limit "$tmp/check${fixed}1" "$script" > "$tmp/$name.vm"
+  $limit "$tmp/check${fixed}0" "$script" > "$tmp/$name.ref"
+  if ! cmp -s "$tmp/$name.ref" "$tmp/$name.vm"; then
+    echo "FAIL $name: engines differ (< reference, > bytecode)"
+    diff "$tmp/$name.ref" "$tmp/$name.vm" | head -20
+    fail=1
+  elif ! cmp -s "$dir/$name.out" "$tmp/$name.vm"; then
+    echo "FAIL $name: output differs from $name.out"
+    diff "$dir/$name.out" "$tmp/$name.vm" | head -20
+    fail=1
+  else
+    echo "ok   $name"
+  fi
+done
+exit $fail
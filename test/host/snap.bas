@@ -0,0 +1,23 @@
+10 DIM WORD W(5)
+20 DIM A(3,2)
+30 LET S$="HELLO"
+40 LET SCORE=7
+50 FOR I=1 TO 3
+60 GOSUB 200
+70 NEXT I
+80 PRINT SUM(W);" ";S$;" ";SCORE;" ";A(3,2)
+90 END
+200 LET W(I)=I*100
+210 LET A(I,2)=I+SCORE
+220 IF I=2 THEN STOP
+230 LET S$=S$+"!"
+240 RETURN
+RUN
+#snap
+PRINT I;" ";S$;" ";W(1)
+CONT
+#snap
+LIST 200
+GOTO 50
+#snap
+CONT
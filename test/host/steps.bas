@@ -0,0 +1,20 @@
+10 FOR I=1 TO 5
+20 GOSUB 100
+30 NEXT I
+40 PRINT "T="; T
+50 STOP
+60 PRINT "CONT ";: FOR J=1 TO 3: LET T=T+J: NEXT J: PRINT T
+70 END
+100 LET T=T+I: PRINT I;: RETURN
+RUN
+CONT
+#step 1
+RUN
+CONT
+#step 4
+RUN
+CONT
+#step 1000
+RUN
+CONT
+GOTO 60
@@ -0,0 +1,26 @@
+10 LET T=0
+20 FOR I=1 TO 5
+30 GOSUB 200
+40 NEXT I
+50 PRINT "T=";T
+60 IF T>20 THEN GOTO 90
+70 PRINT "SMALL"
+80 STOP
+90 DIM A(4)
+100 FOR I=0 TO 4 STEP 2
+110 LET A(I)=I*I
+120 NEXT I
+130 PRINT A(0);" ";A(2);" ";A(4);" ";A(1)
+140 FOR J=3 TO 1
+150 PRINT "NEVER"
+160 NEXT J
+165 STOP
+170 INPUT N
+180 PRINT "N=";N*2
+190 END
+200 LET T=T+I*2
+210 RETURN
+RUN
+CONT
+21
+PRINT T;" ";I;" ";J
@@ -0,0 +1,29 @@
+10 LET A$="Y"
+20 IF A$="Y" THEN GOSUB 100
+30 FOR I=1 TO LEN(A$+"XY"): PRINT I;: NEXT I
+35 PRINT
+40 IF A$="Y" THEN STOP
+50 PRINT "AFTER CONT"
+60 IF A$<>"Y" THEN PRINT "NO"
+70 PRINT LEN(A$)*2; " "; A$<"Z"
+80 FOR J=1 TO LEN(""): PRINT "NEVER": NEXT J
+90 END
+100 PRINT "SUB": RETURN
+RUN
+CONT
+NEW
+5 DIM B(3)
+10 LET A$="Y"
+20 IF A$="Y" AND SUM(B)=0 THEN GOSUB 100
+25 PRINT "BACK"
+30 IF A$="Y" AND SUM(B)=0 THEN FOR I=1 TO 3: PRINT I;: NEXT I
+35 PRINT
+40 IF A$="Y" AND SUM(B)=0 THEN STOP
+50 PRINT "AFTER CONT"
+60 END
+100 PRINT "SUB": RETURN
+RUN
+CONT
+#step 2
+RUN
+CONT
@@ -0,0 +1,15 @@
+10 LET A$="HELLO"
+20 LET B$=A$+", "+"WORLD"
+30 PRINT B$; " "; LEN(B$)
+40 PRINT B$(1 TO 5); "|"; B$(8); "|"; B$( TO 2); "|"; B$(8 TO )
+50 IF A$<B$ THEN PRINT "LESS"
+60 IF A$="HELLO" AND LEN(A$)=5 THEN PRINT "EQUAL"
+70 LET C$=""
+80 FOR I=1 TO 30: LET C$=C$+"AB": NEXT I
+90 PRINT LEN(C$); " "; C$(59 TO 60)
+100 FOR I=1 TO 40: LET D$=C$: LET C$=C$(3 TO )+"XY": NEXT I
+110 PRINT LEN(C$); " "; C$(1 TO 4); " "; C$(57 TO )
+120 LET A$=A$: PRINT A$ <> "HELLO"
+130 PRINT B$(20)
+RUN
+PRINT A$; B$
@@ -0,0 +1,18 @@
+10 DIM BYTE B(4)
+20 DIM WORD W(4)
+30 LET B(0)=255: LET B(1)=256: LET B(2)=-1: LET B(3)=300
+40 LET W(0)=32767: LET W(1)=32768: LET W(2)=-32768: LET W(3)=70000
+50 PRINT B(0); " "; B(1); " "; B(2); " "; B(3)
+60 PRINT W(0); " "; W(1); " "; W(2); " "; W(3)
+70 PRINT SUM(B); " "; SUM(W)
+80 FILL B, 513
+90 SORT W
+100 PRINT B(4); " "; W(0); " "; W(4)
+110 DIM A(4)
+120 FOR I=0 TO 4: LET A(I)=I*1000: NEXT I
+130 COPY A TO B
+140 COPY A TO W
+150 PRINT B(1); " "; B(4); " "; W(4)
+160 DIM BYTE B(1,1)
+170 PRINT SUM(B)
+RUN
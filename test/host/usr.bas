@@ -0,0 +1,17 @@
+10 DIM A(3)
+20 DIM WORD W(2)
+30 DIM BYTE B(2)
+40 FILL A, 2: FILL W, -3: FILL B, 200
+50 PRINT USR ADD(1, 2, 3); " "; USR ADD(A()); " "; USR ADD(W(), B(), 1)
+60 PRINT USR ADD(); " "; USR ADD(2*3, A(1)) + 1
+70 USR TICK
+80 USR TICK(A())
+90 PRINT A(0); " "; USR TICK
+100 FOR I=1 TO 3: LET T=USR TICK: NEXT I: PRINT T
+110 IF USR ADD(1) = 1 THEN PRINT "IF"
+120 PRINT USR FAIL(1)
+130 PRINT "NOT REACHED"
+RUN
+PRINT USR ADD(A(), 10)
+USR FAIL
+PRINT USR NOPE(1)